@@ -17,10 +17,24 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 #include <assert.h>
+#include <errno.h>
+#include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include <unistd.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRID_SIMD 1
+#include <immintrin.h>
+#endif
+
 #include <epoxy/gl.h>
 #include <GLFW/glfw3.h>
 
@@ -30,7 +44,125 @@
 
 /******************************************************************************/
 
-#define GLSL(src) "#version 330 core\n" #src
+#define GLSL_VERSION "#version 330 core\n"
+#define GLSL(src) GLSL_VERSION #src
+#define GLSL_LIB(src) #src
+
+/*
+ *  Functions shared between shaders, which shader_compile splices in
+ *  after the #version line
+ */
+const char* shared_src = GLSL_LIB(
+    /*  Number of label bits when the label texture holds packed
+        distance / label floats (LABEL_PACKED), or 0 if it holds colors  */
+    uniform int label_bits;
+
+    /*  Decodes the cell index from a texel of the Voronoi label texture  */
+    int label(sampler2D voronoi, ivec2 coord)
+    {
+        vec4 t = texelFetch(voronoi, coord, 0);
+        if (label_bits > 0)
+        {
+            uint mask = (1u << label_bits) - 1u;
+            return int((floatBitsToUint(t.r) - 0x800000u) & mask);
+        }
+        return int(255.0f * (t.r + (t.g * 256.0f) + (t.b * 65536.0f)));
+    }
+
+    /*  Packs a distance (0 to 1, in units of the cone radius) and a label
+        into the bits of one float, for LABEL_PACKED and LABEL_QUADS.  The
+        distance is quantized into the high bits and the label fills the
+        low label_bits bits.  The bits are offset by 0x800000 and stay at
+        or below 0x7F7FFFFF, so the float is always finite and normal, and
+        floats then compare in the same order as their bits.  */
+    float pack_label(float dist, int i)
+    {
+        uint levels = 0x7EFFFFFFu >> label_bits;
+        uint d = min(uint(clamp(dist, 0.0f, 1.0f) * float(levels)), levels);
+        return uintBitsToFloat(0x800000u + ((d << label_bits) | uint(i)));
+    }
+
+    /*  Converts an image texel into a stipple weight (darker is heavier)  */
+    float stipple_weight(sampler2D img, ivec2 coord)
+    {
+        return 0.01f + 0.99f * (1.0f - texelFetch(img, coord, 0)[0]);
+    }
+
+    /*  When only every stride'th column is summed, returns the first
+        column to sample on a row.  Offsets follow a low-discrepancy
+        sequence over rows and iterations (phase), so the sampled pixels
+        are evenly spread and change every iteration.  */
+    int sample_offset(int y, int phase, int stride)
+    {
+        return int(fract(y * 0.618034f + phase * 0.754878f) * stride);
+    }
+
+    /*  Sums the pixels of row y that belong to cell i, sampling columns
+        x, x + stride, ... up to xmax.  If tile is nonzero, runs through
+        empty tiles whose ends share a label skip the per-pixel loop:
+        cells are convex, so the whole run has that label, and its weight
+        is taken as the tile's mean (from the tiles map).  */
+    vec4 sum_row(sampler2D voronoi, sampler2D img, sampler2D tiles, int tile,
+                 int i, int y, int x, int xmax, int stride, vec2 origin)
+    {
+        vec4 sum = vec4(0.0f);
+        while (x <= xmax)
+        {
+            int end = xmax;
+            if (tile > 0)
+            {
+                end = min((x / tile + 1) * tile - 1, xmax);
+                vec2 t = texelFetch(tiles, ivec2(x, y) / tile, 0).rg;
+                int a = label(voronoi, ivec2(x, y));
+                if (t.r > 0.0f && a == label(voronoi, ivec2(end, y)))
+                {
+                    int n = (end - x) / stride + 1;
+                    if (a == i)
+                    {
+                        // Mean position of the n sampled pixels
+                        vec2 p = vec2(x + 0.5f + stride * (n - 1) * 0.5f,
+                                      y + 0.5f);
+                        sum += vec4((p - origin) * t.g * n, n, t.g * n);
+                    }
+                    x += n * stride;
+                    continue;
+                }
+            }
+
+            for (; x <= end; x += stride)
+            {
+                ivec2 coord = ivec2(x, y);
+                if (label(voronoi, coord) == i)
+                {
+                    float weight = stipple_weight(img, coord);
+
+                    sum.xy += (coord + 0.5f - origin) * weight;
+                    sum.w += weight;
+                    sum.z += 1.0f;
+                }
+            }
+        }
+        return sum;
+    }
+
+    /*  Per-seed flags for active-set mode:  frozen cells are skipped by
+        the summation passes, so their (empty) sums leave them in place  */
+    uniform usamplerBuffer frozen;
+    uniform bool freeze;
+
+    bool is_frozen(int i)
+    {
+        return freeze && texelFetch(frozen, i).r != 0u;
+    }
+
+    /*  Reads a seed position (0 to 1) from a buffer of xyz triples  */
+    vec2 seed(samplerBuffer seeds, int i)
+    {
+        return vec2(texelFetch(seeds, 3*i).r, texelFetch(seeds, 3*i + 1).r);
+    }
+);
+
+/******************************************************************************/
 
 const char* voronoi_vert_src = GLSL(
     layout(location=0) in vec3 pos;     /*  Absolute coordinates  */
@@ -38,10 +170,12 @@ const char* voronoi_vert_src = GLSL(
     uniform vec2 scale;
 
     out vec3 color_;
+    flat out int label_;
 
     void main()
     {
         gl_Position = vec4(pos.xy*scale + 2.0f*offset - 1.0f, pos.z, 1.0f);
+        label_ = gl_InstanceID;
 
         // Pick color based on instance ID
         int r = gl_InstanceID           % 256;
@@ -61,6 +195,102 @@ const char* voronoi_frag_src = GLSL(
     }
 );
 
+/*
+ *  Packed labelling writes the cone's depth and label as the bits of one
+ *  float (see pack_label), which is resolved with GL_MIN blending instead
+ *  of the depth test.
+ */
+const char* voronoi_packed_frag_src = GLSL(
+    flat in int label_;
+    layout (location=0) out vec4 color;
+
+    void main()
+    {
+        color = vec4(pack_label(gl_FragCoord.z, label_), 0.0f, 0.0f, 0.0f);
+    }
+);
+
+/*
+ *  Bounded-footprint labelling:  each seed is drawn as a square that just
+ *  covers a conservative estimate of its cell, taken from the cell's
+ *  bounding box in the previous labelling (or the whole image if it had
+ *  none), and fragments compute their exact distance to the seed.  The
+ *  distance is in units of the cone radius (half the longer image side),
+ *  so that it packs consistently with the fallback cones.
+ */
+const char* quads_vert_src = GLSL(
+    layout(location=0) in vec2 corner;  /*  -1 to 1  */
+    layout(location=1) in vec2 offset;  /*  0 to 1 */
+
+    uniform sampler2D bounds;
+    uniform vec2 size;                  /*  Image size in pixels  */
+
+    flat out int label_;
+    flat out vec2 center_;
+
+    void main()
+    {
+        label_ = gl_InstanceID;
+        center_ = offset * size;
+
+        // Distance to the farthest corner of last labelling's box, with
+        // a margin for the seeds having moved since then
+        vec4 b = texelFetch(bounds, ivec2(gl_InstanceID, 0), 0);
+        float r = length(size);
+        if (b.x <= -b.z)
+        {
+            vec2 far = max(abs(b.xy - center_), abs(1.0f - b.zw - center_));
+            r = min(r, 1.25f * length(far) + 2.0f);
+        }
+
+        gl_Position = vec4(2.0f * (center_ + corner * r) / size - 1.0f,
+                           0.0f, 1.0f);
+    }
+);
+
+const char* quads_frag_src = GLSL(
+    flat in int label_;
+    flat in vec2 center_;
+    layout (location=0) out vec4 color;
+
+    uniform vec2 size;
+
+    void main()
+    {
+        float d = distance(gl_FragCoord.xy, center_);
+        color = vec4(pack_label(d / (0.5f * max(size.x, size.y)), label_),
+                     0.0f, 0.0f, 0.0f);
+    }
+);
+
+/*
+ *  Coverage check for bounded-footprint labelling:  one point is drawn
+ *  per pixel into a 1 x 1 target, culling every pixel that was labelled,
+ *  so an occlusion query tells whether any pixel was missed.
+ */
+const char* cover_vert_src = GLSL(
+    uniform sampler2D voronoi;
+    uniform int samples;
+
+    void main()
+    {
+        ivec2 tex_size = textureSize(voronoi, 0);
+        ivec2 coord = ivec2(gl_VertexID % tex_size.x, gl_VertexID / tex_size.x);
+        gl_Position = (label(voronoi, coord) < samples)
+            ? vec4(2.0f, 2.0f, 0.0f, 1.0f)
+            : vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+);
+
+const char* cover_frag_src = GLSL(
+    out vec4 color;
+
+    void main()
+    {
+        color = vec4(1.0f);
+    }
+);
+
 /******************************************************************************/
 
 const char* quad_vert_src = GLSL(
@@ -87,42 +317,243 @@ const char* blit_frag_src = GLSL(
 
     void main()
     {
-        vec4 t = texture(tex, pos_);
+        int i = label(tex, ivec2(pos_ * textureSize(tex, 0)));
+        vec3 t = vec3(i % 256, (i / 256) % 256, i / 65536) / 255.0f;
         vec3 rgb = vec3(rand(t.x, t.y), rand(t.y, t.x), rand(t.x - t.y, t.x));
         color = vec4(0.9f + 0.1f*rgb, 1.0f);
     }
 );
 
+/*
+ *  Each fragment sums one cell over a block of image rows.  If relative is
+ *  set, positions are taken relative to the cell's seed, which keeps the
+ *  sums small enough to store at half precision.
+ */
 const char* sum_frag_src = GLSL(
     layout (pixel_center_integer) in vec4 gl_FragCoord;
     out vec4 color;
 
     uniform sampler2D voronoi;
     uniform sampler2D img;
+    uniform samplerBuffer seeds;
+    uniform int block;      /*  Image rows per summation texel  */
+    uniform bool relative;
+    uniform int stride;     /*  Only sum every stride'th column */
+    uniform int phase;
+    uniform sampler2D tiles;
+    uniform int tile;       /*  Tile size, or 0 to sum every pixel  */
 
     void main()
     {
         int my_index = int(gl_FragCoord.x);
         ivec2 tex_size = textureSize(voronoi, 0);
+        vec2 origin = relative ? seed(seeds, my_index) * tex_size : vec2(0.0f);
         color = vec4(0.0f);
+        if (is_frozen(my_index))
+        {
+            return;
+        }
 
-        // Iterate over all columns of the source image, accumulating a
+        // Iterate over all columns of the block of rows, accumulating a
         // weighted sum of the pixels that match our index
-        for (int x=0; x < tex_size.x; x++)
+        int y0 = int(gl_FragCoord.y) * block;
+        int y1 = min(y0 + block, tex_size.y);
+        for (int y=y0; y < y1; y++)
         {
-            ivec2 coord = ivec2(x, gl_FragCoord.y);
-            vec4 t = texelFetch(voronoi, coord, 0);
-            int i = int(255.0f * (t.r + (t.g * 256.0f) + (t.b * 65536.0f)));
-            if (i == my_index)
-            {
-                float weight = 1.0f - texelFetch(img, coord, 0)[0];
-                weight = 0.01f + 0.99f * weight;
+            int x0 = sample_offset(y, phase, stride);
+            color += sum_row(voronoi, img, tiles, tile, my_index,
+                             y, x0, tex_size.x - 1, stride, origin);
+        }
+
+        // Normalize to the 0 - 1 range
+        color.x = color.x / tex_size.x;
+        color.y = color.y / tex_size.y;
+    }
+);
+
+/*
+ *  Span reduction:  one point is drawn per pixel, but only pixels that start
+ *  a run of identical labels along their row survive.  Those scan to the
+ *  end of the run and look up its weighted sums in the per-row prefix sums,
+ *  then land on the matching (label, row) texel of the summation texture.
+ */
+const char* spans_vert_src = GLSL(
+    uniform sampler2D voronoi;
+    uniform sampler2D prefix;   /*  Row prefix sums of weight and x*weight  */
+    uniform int prefix_tile;    /*  Columns between prefix restarts  */
+    uniform samplerBuffer seeds;
+    uniform int samples;
+    uniform int block;          /*  Image rows per summation texel  */
+    uniform int rows;           /*  Rows in the summation texture   */
+    uniform bool relative;      /*  Sum positions relative to seeds */
+
+    flat out vec4 sum_;
+
+    void main()
+    {
+        ivec2 tex_size = textureSize(voronoi, 0);
+        int x = gl_VertexID % tex_size.x;
+        int y = gl_VertexID / tex_size.x;
+        int i = label(voronoi, ivec2(x, y));
+
+        // Points that don't start a span (or belong to a frozen cell) are
+        // moved outside the clip volume
+        if ((x > 0 && label(voronoi, ivec2(x - 1, y)) == i) || is_frozen(i))
+        {
+            gl_Position = vec4(2.0f, 2.0f, 0.0f, 1.0f);
+            return;
+        }
+
+        int end = x;
+        while (end + 1 < tex_size.x && label(voronoi, ivec2(end + 1, y)) == i)
+        {
+            end++;
+        }
 
-                color.xy += (coord + 0.5f) * weight;
-                color.w += weight;
-                color.z += 1.0f;
+        // The prefix sums restart every prefix_tile columns, so the span
+        // is summed one tile at a time
+        vec2 span = vec2(0.0f);
+        for (int a=x; a <= end; a = (a / prefix_tile + 1) * prefix_tile)
+        {
+            int b = min(end, (a / prefix_tile + 1) * prefix_tile - 1);
+            span += texelFetch(prefix, ivec2(b, y), 0).xy;
+            if (a % prefix_tile != 0)
+            {
+                span -= texelFetch(prefix, ivec2(a - 1, y), 0).xy;
             }
         }
+        float weight = span.x;
+
+        // Same layout as sum_frag_src
+        vec2 origin = relative ? seed(seeds, i) : vec2(0.0f);
+        sum_ = vec4(span.y - origin.x * weight,
+                    weight * ((y + 0.5f) / tex_size.y - origin.y),
+                    float(end - x + 1), weight);
+        gl_Position = vec4(2.0f * (i + 0.5f) / samples - 1.0f,
+                           2.0f * (y / block + 0.5f) / rows - 1.0f,
+                           0.0f, 1.0f);
+    }
+);
+
+const char* spans_frag_src = GLSL(
+    flat in vec4 sum_;
+    out vec4 color;
+
+    void main()
+    {
+        color = sum_;
+    }
+);
+
+/*
+ *  Per-cell bounding boxes:  the ends of each run of labels along a row
+ *  are drawn as points into the cell's texel of a samples x 1 texture,
+ *  and min-blending reduces them to (xmin, ymin, -xmax, -ymax).
+ */
+const char* bounds_vert_src = GLSL(
+    uniform sampler2D voronoi;
+    uniform int samples;
+
+    flat out vec4 bounds_;
+
+    void main()
+    {
+        ivec2 tex_size = textureSize(voronoi, 0);
+        int x = gl_VertexID % tex_size.x;
+        int y = gl_VertexID / tex_size.x;
+        int i = label(voronoi, ivec2(x, y));
+
+        // Pixels inside a run can't extend the bounds, so cull them
+        if (x > 0 && x + 1 < tex_size.x &&
+            label(voronoi, ivec2(x - 1, y)) == i &&
+            label(voronoi, ivec2(x + 1, y)) == i)
+        {
+            gl_Position = vec4(2.0f, 2.0f, 0.0f, 1.0f);
+            return;
+        }
+
+        bounds_ = vec4(x, y, -x, -y);
+        gl_Position = vec4(2.0f * (i + 0.5f) / samples - 1.0f, 0.0f,
+                           0.0f, 1.0f);
+    }
+);
+
+const char* bounds_frag_src = GLSL(
+    flat in vec4 bounds_;
+    out vec4 color;
+
+    void main()
+    {
+        color = bounds_;
+    }
+);
+
+/*
+ *  Bounding-box summation:  one quad is drawn per cell, covering only the
+ *  rows of its column in the summation texture that the cell spans, and
+ *  each fragment only scans the cell's range of columns.
+ */
+const char* boxes_vert_src = GLSL(
+    layout(location=0) in vec2 pos;     /*  Quad corner (-1 to 1)  */
+
+    uniform sampler2D bounds;
+    uniform int samples;
+    uniform int block;      /*  Image rows per summation texel  */
+    uniform int rows;       /*  Rows in the summation texture   */
+
+    flat out ivec4 box_;    /*  xmin, ymin, xmax, ymax (in pixels)  */
+
+    void main()
+    {
+        vec4 b = texelFetch(bounds, ivec2(gl_InstanceID, 0), 0);
+        box_ = ivec4(b.xy, -b.zw);
+
+        // Cells that received no pixels (or are frozen) collapse to nothing
+        if (b.x > -b.z || is_frozen(gl_InstanceID))
+        {
+            gl_Position = vec4(2.0f, 2.0f, 0.0f, 1.0f);
+            return;
+        }
+
+        float x = (pos.x < 0.0f) ? gl_InstanceID : gl_InstanceID + 1;
+        float y = (pos.y < 0.0f) ? box_.y / block : box_.w / block + 1;
+        gl_Position = vec4(2.0f * x / samples - 1.0f,
+                           2.0f * y / rows - 1.0f, 0.0f, 1.0f);
+    }
+);
+
+const char* boxes_frag_src = GLSL(
+    layout (pixel_center_integer) in vec4 gl_FragCoord;
+    flat in ivec4 box_;
+    out vec4 color;
+
+    uniform sampler2D voronoi;
+    uniform sampler2D img;
+    uniform samplerBuffer seeds;
+    uniform int block;
+    uniform bool relative;
+    uniform int stride;
+    uniform int phase;
+    uniform sampler2D tiles;
+    uniform int tile;
+
+    void main()
+    {
+        int my_index = int(gl_FragCoord.x);
+        ivec2 tex_size = textureSize(voronoi, 0);
+        vec2 origin = relative ? seed(seeds, my_index) * tex_size : vec2(0.0f);
+        color = vec4(0.0f);
+
+        int y0 = max(int(gl_FragCoord.y) * block, box_.y);
+        int y1 = min((int(gl_FragCoord.y) + 1) * block - 1, box_.w);
+        for (int y=y0; y <= y1; y++)
+        {
+            // First sampled column at or after the left edge of the box
+            int o = sample_offset(y, phase, stride);
+            int x0 = box_.x + (o - box_.x % stride + stride) % stride;
+            color += sum_row(voronoi, img, tiles, tile, my_index,
+                             y, x0, box_.z, stride, origin);
+        }
 
         // Normalize to the 0 - 1 range
         color.x = color.x / tex_size.x;
@@ -133,8 +564,11 @@ const char* sum_frag_src = GLSL(
 const char* feedback_src = GLSL(
     layout (location=0) in uint index;
     out vec3 pos;
+    out vec2 cell;                  /*  Mass and pixel count (reseeding)  */
 
     uniform sampler2D summed;
+    uniform samplerBuffer seeds;    /*  Seeds from before this update  */
+    uniform bool relative;          /*  Sums are relative to the seeds */
 
     void main()
     {
@@ -149,7 +583,22 @@ const char* feedback_src = GLSL(
             weight += t.w;
             count += t.z;
         }
+        // If no pixels of this cell were sampled, leave its seed in place
+        // (and mark the cell empty, unless it was frozen)
+        cell = vec2(weight, count);
+        if (count == 0.0f)
+        {
+            pos = vec3(seed(seeds, int(index)),
+                       texelFetch(seeds, 3*int(index) + 2).r);
+            cell.x = is_frozen(int(index)) ? -1.0f : 0.0f;
+            return;
+        }
+
         pos.xy /= weight;
+        if (relative)
+        {
+            pos.xy += seed(seeds, int(index));
+        }
         pos.z = weight / count;
     }
 );
@@ -176,8 +625,13 @@ GLuint shader_compile(GLenum type, const GLchar* src)
 {
     assert(type == GL_VERTEX_SHADER || type == GL_FRAGMENT_SHADER);
 
+    /*  Splice the shared functions in after the #version line  */
+    const size_t n = strlen(GLSL_VERSION);
+    assert(!strncmp(src, GLSL_VERSION, n));
+    const GLchar* srcs[] = {GLSL_VERSION, shared_src, src + n};
+
     GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &src, NULL);
+    glShaderSource(shader, 3, srcs, NULL);
     glCompileShader(shader);
 
     check_shader(shader);
@@ -323,20 +777,112 @@ void fbo_check(const char* description)
     }
 }
 
+/******************************************************************************/
+
+typedef struct ParallelJob_
+{
+    void (*fn)(void*, unsigned);
+    void* data;
+    unsigned t;
+} ParallelJob;
+
+void* parallel_job(void* job)
+{
+    ParallelJob* j = (ParallelJob*)job;
+    j->fn(j->data, j->t);
+    return NULL;
+}
+
+/*
+ *  Runs fn(data, t) on each of n threads (for t in 0 to n - 1), returning
+ *  once they have all finished.  Thread 0 is the calling thread.
+ */
+void parallel_for(unsigned n, void (*fn)(void*, unsigned), void* data)
+{
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * n);
+    ParallelJob* jobs = (ParallelJob*)malloc(sizeof(ParallelJob) * n);
+
+    for (unsigned t=1; t < n; ++t)
+    {
+        jobs[t] = (ParallelJob){fn, data, t};
+        pthread_create(&threads[t], NULL, parallel_job, &jobs[t]);
+    }
+    fn(data, 0);
+    for (unsigned t=1; t < n; ++t)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(jobs);
+    free(threads);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 typedef struct Config_ {
     stbi_uc* img;           /*  Pointer to raw image data  */
 
-    uint16_t width, height; /*  Image size   */
+    uint16_t width, height; /*  Working resolution (of img)   */
+    uint16_t out_width, out_height; /*  Original image size, used for output */
     uint16_t samples;       /*  Number of Voronoi cells */
     uint16_t resolution;    /*  Resolution of Voronoi cones  */
+    uint16_t dot_resolution;    /*  Resolution of stipple dots   */
+
+    enum { LABEL_CONES, LABEL_PACKED, LABEL_QUADS } label;  /*  Labelling  */
+    enum { BACKEND_GPU, BACKEND_CPU, BACKEND_GRID,
+           BACKEND_DELAUNAY } backend;  /*  Where iterations run  */
+    bool validate;          /*  Compare GPU labels with the CPU labeller  */
+    unsigned batch;         /*  Pixels per minibatch iteration, or 0 for
+                                full iterations (CPU backends)          */
+    float freeze;           /*  Displacement (in pixels) below which a
+                                seed may be frozen, or 0 to sum every
+                                cell every iteration                    */
+    float relabel;          /*  Displacement (in pixels) above which a
+                                seed's surroundings are relabelled, or 0
+                                to relabel everything every iteration   */
+    bool reseed;            /*  Move empty cells' seeds into the heaviest
+                                cells after each update                 */
+    unsigned reorder;       /*  Iterations between sorting the seeds
+                                along a Hilbert curve, or 0 for never   */
+    uint32_t* order;        /*  Original index of the seed in each slot,
+                                or NULL if the seeds are never sorted   */
+    float* seeds;           /*  Seeds to start from (x, y, weight
+                                triples) instead of sampling, or NULL   */
+    uint16_t* sweep;        /*  Ascending seed counts to converge and
+                                save in turn, or NULL                   */
+    unsigned sweep_count;
+    uint16_t cone_resolution;   /*  Requested cone resolution, or 0  */
+    bool lbg;               /*  Adapt the seed count to the image (LBG) */
+
+    enum { SUM_FULL, SUM_SPANS, SUM_BOXES, SUM_SORT } sum;  /*  Summation  */
+    unsigned threads;       /*  Worker threads for CPU passes  */
+    unsigned sum_rows;      /*  Image rows reduced into each summation texel */
+    bool sum_half;          /*  Store seed-relative sums at half precision  */
+    float skip_empty;       /*  Darkness below which a tile is treated as
+                                empty and summed in closed form; 0 to sum
+                                every pixel                             */
 
     float sx, sy;           /*  Scale (used to adjust for aspect ratio) */
     float radius;           /*  Stipple radius (in arbitrary units)     */
 
     int iter;               /*  Number of iterations; -1 if interactive */
+    int step;               /*  Number of iterations completed so far   */
+    int subsample;          /*  Early iterations that estimate centroids
+                                from a subset of pixels                 */
+    double budget;          /*  Wall-clock time budget in seconds; 0 if
+                                unlimited (limits iter if both are set) */
     const char* out;        /*  Output file name  */
+
+    int stream;             /*  File descriptor for seed frames, or -1  */
+    int stream_every;       /*  Iterations between streamed frames      */
+
+    const char* checkpoint; /*  Checkpoint file name, or NULL           */
+    int checkpoint_every;   /*  Iterations between checkpoints          */
+    const char* resume;     /*  Checkpoint to resume from, or NULL      */
+
+    uint64_t rng;           /*  Random number generator state  */
+    uint64_t hash;          /*  Hash of the image and settings, used to
+                                check that a checkpoint matches the job */
 } Config;
 
 void config_set_aspect_ratio(Config* c)
@@ -353,280 +899,4773 @@ void config_set_aspect_ratio(Config* c)
     }
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-typedef struct Voronoi_ {
-    GLuint vao;     /*  VAO with bound cone and offsets */
-    GLuint pts;     /*  VBO containing point locations  */
-    GLuint prog;    /*  Shader program (compiled)       */
-    GLuint img;     /*  Target image texture            */
-
-    GLuint tex;     /*  RGB texture (bound to fbo)          */
-    GLuint depth;   /*  Depth texture (bound to fbo)        */
-    GLuint fbo;     /*  Framebuffer for render-to-texture   */
-} Voronoi;
-
 /*
- *  Builds a vertex buffer to draw a single cone
- *  Must be called with a bound VAO; binds the cone into vertex attribute
- *  slot 0
+ *  Returns the number of low bits that hold the label in a packed label
+ *  texel (0 unless packed labelling is used).  This is enough bits to
+ *  store the sample count itself, which marks unlabelled pixels.
  */
-void voronoi_cone_bind(uint16_t n)
+int config_label_bits(const Config* c)
 {
-    GLuint vbo;
-    size_t bytes = (n + 2) * 3 * sizeof(float);
-    float* buf = (float*)malloc(bytes);
-
-    /* This is the tip of the cone */
-    buf[0] = 0;
-    buf[1] = 0;
-    buf[2] = -1;
-
-    for (uint16_t i=0; i <= n; ++i)
+    int bits = 0;
+    if (c->label != LABEL_CONES)
     {
-        float angle = 2 * M_PI * i / n;
-        buf[i*3 + 3] = cos(angle);
-        buf[i*3 + 4] = sin(angle);
-        buf[i*3 + 5] = 1;
+        while ((1u << bits) <= c->samples)
+        {
+            bits++;
+        }
     }
-
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, bytes, buf, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    free(buf);
+    return bits;
 }
 
 /*
- *  Builds and returns the VBO for cone instances, binding it to vertex
- *  attribute slot 1
+ *  Returns a newly allocated copy of a single-channel image, resampled to
+ *  the given size with a separable tent filter.  When shrinking, the filter
+ *  is widened to cover the full footprint of each output pixel.
  */
-GLuint voronoi_instances(const Config* c)
+stbi_uc* image_resample(const stbi_uc* src, int w, int h, int nw, int nh)
 {
-    GLuint vbo;
-    size_t bytes = c->samples * 3 * sizeof(float);
-    float* buf = (float*)malloc(bytes);
+    float* tmp = (float*)malloc(sizeof(float) * nw * h);
+    stbi_uc* out = (stbi_uc*)malloc(nw * nh);
 
-    /*  Fill the buffer with values between 0 and 1, using        *
-     *  rejection sampling to create a good initial distribution  */
-    uint16_t i=0;
-    while (i < c->samples)
+    /*  Each pass resamples one axis, reading from (in) with the given    *
+     *  strides and writing to (out) through a float or byte pointer    */
+    for (int pass=0; pass < 2; ++pass)
     {
-        int x = rand() % c->width;
-        int y = rand() % c->height;
-        uint8_t p = c->img[y*c->width + x];
+        const int n  = pass ? h : w;    /*  Source samples along this axis */
+        const int nn = pass ? nh : nw;  /*  Output samples along this axis */
+        const int lines = pass ? nw : h;
 
-        if ((rand() % 256) > p)
+        const float scale = (float)nn / n;
+        const float k = fminf(scale, 1.0f); /*  Filter compression  */
+        const float support = 1.0f / k;
+
+        for (int i=0; i < nn; ++i)
         {
-            buf[3*i]     = (x + 0.5f) / c->width;
-            buf[3*i + 1] = (y + 0.5f) / c->height;
-            buf[3*i + 2] = 0.0f;
-            i++;
-        }
+            const float center = (i + 0.5f) / scale - 0.5f;
+            const int lo = (int)ceilf(center - support);
+            const int hi = (int)floorf(center + support);
+
+            for (int line=0; line < lines; ++line)
+            {
+                float sum = 0;
+                float total = 0;
+                for (int j=lo; j <= hi; ++j)
+                {
+                    float wt = 1.0f - fabsf(j - center) * k;
+                    if (wt <= 0)
+                    {
+                        continue;
+                    }
+                    int jj = j < 0 ? 0 : (j >= n ? n - 1 : j);
+                    sum += wt * (pass ? tmp[jj*nw + line]
+                                      : src[line*w + jj]);
+                    total += wt;
+                }
+
+                if (pass)
+                {
+                    out[i*nw + line] = (stbi_uc)(sum / total + 0.5f);
+                }
+                else
+                {
+                    tmp[line*nw + i] = sum / total;
+                }
+            }
+        }
+    }
+
+    free(tmp);
+    return out;
+}
+
+/*  Bounds on the automatic cone and dot tessellation, which aims for a
+ *  maximum error of TESSELLATION_ERROR pixels                          */
+#define TESSELLATION_MIN 8
+#define TESSELLATION_MAX 1024
+#define TESSELLATION_ERROR 0.25
+
+/*
+ *  Picks a working resolution that gives roughly the requested number of
+ *  pixels per Voronoi cell, resampling the image to match.  The original
+ *  size is kept in out_width and out_height for output.
+ */
+void config_set_resolution(Config* c, unsigned cell_pixels)
+{
+    const double scale = sqrt((double)cell_pixels * c->samples /
+                              ((double)c->width * c->height));
+
+    /*  Don't bother resampling for small changes  */
+    if (fabs(scale - 1) < 0.1)
+    {
+        return;
+    }
+
+    double w = fmax(1, round(c->width * scale));
+    double h = fmax(1, round(c->height * scale));
+    if (w > UINT16_MAX || h > UINT16_MAX)
+    {
+        const double m = UINT16_MAX / fmax(w, h);
+        w = fmax(1, floor(w * m));
+        h = fmax(1, floor(h * m));
+    }
+
+    fprintf(stderr, "Working resolution: %i x %i (from %u x %u)\n",
+            (int)w, (int)h, c->width, c->height);
+
+    stbi_uc* img = image_resample(c->img, c->width, c->height, w, h);
+    stbi_image_free(c->img);
+
+    c->img = img;
+    c->width = (uint16_t)w;
+    c->height = (uint16_t)h;
+    config_set_aspect_ratio(c);
+}
+
+/*
+ *  Returns the number of segments needed for a polygon to stay within err
+ *  of a circle of radius r (with r * (1 - cos(pi / n)) <= err)
+ */
+uint16_t tessellation(double r, double err)
+{
+    if (err >= r)
+    {
+        return TESSELLATION_MIN;
+    }
+    double n = ceil(M_PI / acos(1 - err / r));
+    return (uint16_t)fmin(fmax(n, TESSELLATION_MIN), TESSELLATION_MAX);
+}
+
+/*
+ *  Picks the cone and dot resolutions.  Cones only need to be accurate out
+ *  to the largest cells, whose radius is estimated from the mean cell size
+ *  scaled up by how much lighter than average the lightest pixels are
+ *  (cells cover roughly equal weight).  Dots only need to be accurate out
+ *  to the largest stipple.  A nonzero cone_resolution overrides the first.
+ */
+void config_set_tessellation(Config* c, unsigned cone_resolution)
+{
+    const double cone = fmax(c->width, c->height) / 2.0;
+    const double dot = c->radius * fmax(c->width, c->height) / 2.0;
+
+    double total = 0, lightest = 1;
+    for (size_t i=0; i < (size_t)c->width * c->height; ++i)
+    {
+        double w = 0.01 + 0.99 * (1.0 - c->img[i] / 255.0);
+        total += w;
+        lightest = fmin(lightest, w);
+    }
+    const double mean = total / ((double)c->width * c->height);
+    const double cell = sqrt((double)c->width * c->height /
+                             (M_PI * c->samples)) * sqrt(mean / lightest);
+    const double r = fmin(cell, cone);
+
+    c->resolution = cone_resolution ? cone_resolution
+                                    : tessellation(r, TESSELLATION_ERROR);
+    c->dot_resolution = tessellation(dot, TESSELLATION_ERROR);
+
+    fprintf(stderr, "Cone resolution: %u (%.3f px error at a %.1f px cell)"
+                    "; dot resolution: %u\n",
+            c->resolution, r * (1 - cos(M_PI / c->resolution)), r,
+            c->dot_resolution);
+}
+
+/*
+ *  Returns a pseudo-random 32-bit value (xorshift64*), advancing the
+ *  generator state stored in the config
+ */
+uint32_t config_rand(Config* c)
+{
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return (uint32_t)((c->rng * 2685821657736338717ULL) >> 32);
+}
+
+/*
+ *  Sorted seeds remember where they started, for stable output:  this
+ *  (re)sets the record to the identity, if the seeds are ever sorted
+ */
+void config_set_order(Config* c)
+{
+    if (c->reorder)
+    {
+        c->order = (uint32_t*)realloc(c->order,
+                                      c->samples * sizeof(uint32_t));
+        for (unsigned i=0; i < c->samples; ++i)
+        {
+            c->order[i] = i;
+        }
+    }
+}
+
+/*
+ *  Hashes (with 64-bit FNV-1a) everything that a checkpoint depends on
+ */
+void config_set_hash(Config* c)
+{
+    uint64_t h = 14695981039346656037ULL;
+    const uint16_t params[] = {c->width, c->height, c->samples, c->resolution};
+
+    const uint8_t* p = (const uint8_t*)params;
+    for (size_t i=0; i < sizeof(params); ++i)
+    {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    for (size_t i=0; i < (size_t)c->width * c->height; ++i)
+    {
+        h = (h ^ c->img[i]) * 1099511628211ULL;
+    }
+    c->hash = h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct Voronoi_ {
+    GLuint vao;     /*  VAO with bound cone and offsets */
+    GLuint pts;     /*  VBO containing point locations  */
+    GLuint prog;    /*  Shader program (compiled)       */
+    GLuint img;     /*  Target image texture            */
+
+    GLuint tex;     /*  RGB (or packed R32F) texture (bound to fbo)  */
+    GLuint depth;   /*  Depth texture (bound to fbo), unless packed  */
+    GLuint fbo;     /*  Framebuffer for render-to-texture   */
+
+    GLuint prev;        /*  Copy of pts taken when tex was drawn   */
+    GLuint prev_tex;    /*  Buffer texture (R32F) viewing prev     */
+
+    /*  Per-cell bounding boxes, reduced from tex after each draw.        *
+     *  These are only built when needed (otherwise bounds is zero).      */
+    GLuint bounds;          /*  samples x 1 RGBA32F texture     */
+    GLuint bounds_fbo;      /*  Framebuffer bound to bounds     */
+    GLuint bounds_prog;     /*  Reduction shader program        */
+    GLuint bounds_vao;      /*  Empty VAO (points use gl_VertexID)  */
+
+    /*  Bounded-footprint labelling (LABEL_QUADS), which also uses bounds  */
+    GLuint quad_vao;        /*  VAO with a quad and the seed offsets    */
+    GLuint quad_prog;       /*  Seed quad shader program                */
+    GLuint cover_prog;      /*  Coverage check shader program           */
+    GLuint cover_tex;       /*  1 x 1 target for the coverage check     */
+    GLuint cover_fbo;
+    GLuint cover_query;     /*  Whether any pixel was left unlabelled   */
+    bool cover_pending;     /*  Set if cover_query hasn't been counted  */
+    unsigned fallbacks;     /*  Labellings that needed the full cones   */
+
+    /*  Incremental relabelling:  if partial is set, only these scissor   *
+     *  rectangles are redrawn, and the rest of tex is kept               */
+    bool partial;
+    const GLint (*rects)[4];
+    unsigned rect_count;
+} Voronoi;
+
+/*
+ *  Builds a vertex buffer to draw a single cone
+ *  Must be called with a bound VAO; binds the cone into vertex attribute
+ *  slot 0
+ */
+void voronoi_cone_bind(uint16_t n)
+{
+    GLuint vbo;
+    size_t bytes = (n + 2) * 3 * sizeof(float);
+    float* buf = (float*)malloc(bytes);
+
+    /* This is the tip of the cone */
+    buf[0] = 0;
+    buf[1] = 0;
+    buf[2] = -1;
+
+    for (uint16_t i=0; i <= n; ++i)
+    {
+        float angle = 2 * M_PI * i / n;
+        buf[i*3 + 3] = cos(angle);
+        buf[i*3 + 4] = sin(angle);
+        buf[i*3 + 5] = 1;
     }
 
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, bytes, buf, GL_DYNAMIC_DRAW);
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 3*sizeof(float), 0);
-    glVertexAttribDivisor(1, 1);
+    glBufferData(GL_ARRAY_BUFFER, bytes, buf, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
     free(buf);
-    return vbo;
 }
 
-Voronoi* voronoi_new(const Config* cfg, uint8_t* img)
+/*
+ *  Returns a newly allocated array of initial seed positions (x, y, weight
+ *  triples), with positions between 0 and 1
+ */
+float* seeds_new(Config* c)
 {
-    Voronoi* v = (Voronoi*)calloc(1, sizeof(Voronoi));
-    glGenVertexArrays(1, &v->vao);
-
-    glBindVertexArray(v->vao);
-        voronoi_cone_bind(cfg->resolution);         /* Uses bound VAO   */
-        v->pts = voronoi_instances(cfg);            /* (same) */
-    glBindVertexArray(0);
+    float* buf = (float*)malloc(c->samples * 3 * sizeof(float));
 
-    v->prog = program_link(
-        shader_compile(GL_VERTEX_SHADER, voronoi_vert_src),
-        shader_compile(GL_FRAGMENT_SHADER, voronoi_frag_src));
+    /*  A sweep warm-starts each count from the last one's seeds  */
+    if (c->seeds)
+    {
+        memcpy(buf, c->seeds, c->samples * 3 * sizeof(float));
+        return buf;
+    }
 
-    v->tex   = texture_new();
-    v->depth = texture_new();
-    v->img   = texture_new();
+    /*  Fill the buffer with values between 0 and 1, using        *
+     *  rejection sampling to create a good initial distribution  */
+    uint16_t i=0;
+    while (i < c->samples)
+    {
+        int x = config_rand(c) % c->width;
+        int y = config_rand(c) % c->height;
+        uint8_t p = c->img[y*c->width + x];
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glBindTexture(GL_TEXTURE_2D, v->tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg->width, cfg->height,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-    glBindTexture(GL_TEXTURE_2D, v->depth);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, cfg->width, cfg->height,
-                 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-    glBindTexture(GL_TEXTURE_2D, v->img);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, cfg->width, cfg->height,
-                 0, GL_RED, GL_UNSIGNED_BYTE, img);
+        if ((config_rand(c) % 256) > p)
+        {
+            buf[3*i]     = (x + 0.5f) / c->width;
+            buf[3*i + 1] = (y + 0.5f) / c->height;
+            buf[3*i + 2] = 0.0f;
+            i++;
+        }
+    }
+    return buf;
+}
 
-    glGenFramebuffers(1, &v->fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, v->fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                           GL_TEXTURE_2D, v->tex, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-                           GL_TEXTURE_2D, v->depth, 0);
-    fbo_check("voronoi");
+/*
+ *  Distance along a Hilbert curve filling a 2^16 x 2^16 grid
+ */
+static uint32_t hilbert_key(uint32_t x, uint32_t y)
+{
+    const uint32_t n = 1u << 16;
+    uint32_t d = 0;
+    for (uint32_t s=n / 2; s > 0; s /= 2)
+    {
+        const uint32_t rx = (x & s) != 0;
+        const uint32_t ry = (y & s) != 0;
+        d += s * s * ((3 * rx) ^ ry);
 
-    teardown(NULL);
-    return v;
+        /*  Rotate the quadrant so the curve is continuous  */
+        if (!ry)
+        {
+            if (rx)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            const uint32_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
 }
 
-void voronoi_draw(Config* cfg, Voronoi* v)
+typedef struct SeedKey_
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, v->fbo);
+    uint32_t key;
+    uint32_t index;
+} SeedKey;
 
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    glViewport(0, 0, cfg->width, cfg->height);
+static int seed_key_cmp(const void* a, const void* b)
+{
+    const SeedKey* ka = (const SeedKey*)a;
+    const SeedKey* kb = (const SeedKey*)b;
+    if (ka->key != kb->key)
+    {
+        return ka->key < kb->key ? -1 : 1;
+    }
+    return ka->index < kb->index ? -1 : (ka->index > kb->index);
+}
 
-    glEnable(GL_DEPTH_TEST);
-    glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+/*
+ *  Returns a newly allocated permutation that sorts the seeds along a
+ *  Hilbert curve over the image, so that seeds with nearby indices are
+ *  nearby in the image:  perm[i] is the seed that should move to slot i
+ */
+uint32_t* seeds_hilbert(const Config* c, const float (*pts)[3])
+{
+    SeedKey* keys = (SeedKey*)malloc(c->samples * sizeof(SeedKey));
+    const float scale = 65535.0f / (c->width > c->height ? c->width
+                                                          : c->height);
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        /*  fminf and fmaxf discard NaN, so stray seeds stay in range  */
+        const float x = fminf(fmaxf(pts[i][0] * c->width * scale, 0), 65535);
+        const float y = fminf(fmaxf(pts[i][1] * c->height * scale, 0), 65535);
+        keys[i] = (SeedKey){ .key = hilbert_key((uint32_t)x, (uint32_t)y),
+                             .index = i };
+    }
+    qsort(keys, c->samples, sizeof(SeedKey), seed_key_cmp);
 
-    glUseProgram(v->prog);
-    glBindVertexArray(v->vao);
-    glUniform2f(glGetUniformLocation(v->prog, "scale"), cfg->sx, cfg->sy);
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->resolution+2, cfg->samples);
+    uint32_t* perm = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        perm[i] = keys[i].index;
+    }
+    free(keys);
+    return perm;
+}
 
-    teardown(viewport);
+/*
+ *  Rearranges a per-seed array (of elements of the given size) so that
+ *  element i becomes the old element perm[i]
+ */
+void seeds_permute(const Config* c, const uint32_t* perm,
+                   void* data, size_t size)
+{
+    char* old = (char*)malloc(c->samples * size);
+    memcpy(old, data, c->samples * size);
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        memcpy((char*)data + i * size, old + perm[i] * size, size);
+    }
+    free(old);
 }
 
-////////////////////////////////////////////////////////////////////////////////
+/*
+ *  Copies the seeds into out (x, y, weight triples) in their original
+ *  order, undoing any reordering (see c->order)
+ */
+void seeds_save(const Config* c, const float (*pts)[3], float* out)
+{
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        memcpy(&out[3 * (c->order ? c->order[i] : i)], pts[i],
+               3 * sizeof(float));
+    }
+}
 
-typedef struct Sum_
+/*
+ *  Returns a newly allocated copy of the seeds in their original order
+ */
+float* seeds_unordered(const Config* c, const float (*pts)[3])
 {
-    GLuint prog;
-    GLuint fbo;
-    GLuint tex;
-    GLuint vao;
-} Sum;
+    float* out = (float*)malloc(c->samples * 3 * sizeof(float));
+    seeds_save(c, pts, out);
+    return out;
+}
 
-Sum* sum_new(Config* config)
+/*
+ *  Builds and returns the VBO for cone instances, binding it to vertex
+ *  attribute slot 1
+ */
+GLuint voronoi_instances(Config* c)
 {
-    Sum* sum = (Sum*)calloc(1, sizeof(Sum));
-    sum->vao = quad_new();
-    sum->tex = texture_new();
-    glBindTexture(GL_TEXTURE_2D, sum->tex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config->samples, config->height,
-                     0, GL_RGB, GL_FLOAT, 0);
+    GLuint vbo;
+    size_t bytes = c->samples * 3 * sizeof(float);
+    float* buf = seeds_new(c);
 
-    glGenFramebuffers(1, &sum->fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, sum->fbo);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, bytes, buf, GL_DYNAMIC_DRAW);
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 3*sizeof(float), 0);
+    glVertexAttribDivisor(1, 1);
+
+    free(buf);
+    return vbo;
+}
+
+/*
+ *  Allocates the per-cell bounding box texture and its reduction pass
+ */
+void voronoi_bounds_new(Config* cfg, Voronoi* v)
+{
+    v->bounds = texture_new();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, cfg->samples, 1,
+                 0, GL_RGBA, GL_FLOAT, 0);
+
+    glGenFramebuffers(1, &v->bounds_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, v->bounds_fbo);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                           GL_TEXTURE_2D, sum->tex, 0);
-    fbo_check("sum");
+                           GL_TEXTURE_2D, v->bounds, 0);
+    fbo_check("bounds");
 
-    sum->prog = program_link(
-        shader_compile(GL_VERTEX_SHADER, quad_vert_src),
-        shader_compile(GL_FRAGMENT_SHADER, sum_frag_src));
+    /*  Start with empty boxes, which the seed quads read as unbounded  */
+    const GLfloat empty[4] = {1e9f, 1e9f, 1e9f, 1e9f};
+    glClearBufferfv(GL_COLOR, 0, empty);
 
-    teardown(NULL);
-    return sum;
+    glGenVertexArrays(1, &v->bounds_vao);
+    v->bounds_prog = program_link(
+        shader_compile(GL_VERTEX_SHADER, bounds_vert_src),
+        shader_compile(GL_FRAGMENT_SHADER, bounds_frag_src));
 }
 
-void sum_draw(Config* cfg, Voronoi* v, Sum* s)
+/*
+ *  Builds the seed quads and the coverage check for LABEL_QUADS
+ */
+void voronoi_quads_new(Voronoi* v)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, s->fbo);
+    v->quad_vao = quad_new();
+    glBindVertexArray(v->quad_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 3*sizeof(float), 0);
+        glVertexAttribDivisor(1, 1);
+    glBindVertexArray(0);
 
-    // Save viewport size and restore it later
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    glViewport(0, 0, cfg->samples, cfg->height);
+    v->quad_prog = program_link(
+        shader_compile(GL_VERTEX_SHADER, quads_vert_src),
+        shader_compile(GL_FRAGMENT_SHADER, quads_frag_src));
+    v->cover_prog = program_link(
+        shader_compile(GL_VERTEX_SHADER, cover_vert_src),
+        shader_compile(GL_FRAGMENT_SHADER, cover_frag_src));
+
+    v->cover_tex = texture_new();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 1, 1, 0, GL_RED,
+                 GL_UNSIGNED_BYTE, 0);
+    glGenFramebuffers(1, &v->cover_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, v->cover_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, v->cover_tex, 0);
+    fbo_check("cover");
 
-    glClear(GL_COLOR_BUFFER_BIT);
+    glGenQueries(1, &v->cover_query);
+}
 
-    glUseProgram(s->prog);
-    glBindVertexArray(s->vao);
+/*
+ *  Returns the number of regions to redraw (1 if redrawing everything)
+ */
+static unsigned voronoi_regions(Voronoi* v)
+{
+    return v->partial ? v->rect_count : 1;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, v->tex);
-    glUniform1i(glGetUniformLocation(s->prog, "voronoi"), 0);
+/*
+ *  Restricts drawing to the r'th region, when relabelling incrementally
+ */
+static void voronoi_scissor(Voronoi* v, unsigned r)
+{
+    if (v->partial)
+    {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(v->rects[r][0], v->rects[r][1],
+                  v->rects[r][2], v->rects[r][3]);
+    }
+}
 
-    glActiveTexture(GL_TEXTURE1);
+/*
+ *  Draws the seed quads into the bound (packed, min-blended) label target,
+ *  then checks for unlabelled pixels and, only if there are any, draws the
+ *  full cones over the top.  The check is resolved on the GPU through
+ *  conditional rendering, so the CPU never waits on it.
+ */
+void voronoi_quads_draw(Config* cfg, Voronoi* v)
+{
+    /*  Count the previous labelling's fallback, which finished long ago  */
+    if (v->cover_pending)
+    {
+        GLuint missed;
+        glGetQueryObjectuiv(v->cover_query, GL_QUERY_RESULT, &missed);
+        v->fallbacks += (missed != 0);
+    }
+
+    glUseProgram(v->quad_prog);
+    glBindVertexArray(v->quad_vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, v->bounds);
+    glUniform1i(glGetUniformLocation(v->quad_prog, "bounds"), 0);
+    glUniform2f(glGetUniformLocation(v->quad_prog, "size"),
+                cfg->width, cfg->height);
+    glUniform1i(glGetUniformLocation(v->quad_prog, "label_bits"),
+                config_label_bits(cfg));
+    for (unsigned r=0; r < voronoi_regions(v); ++r)
+    {
+        voronoi_scissor(v, r);
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, cfg->samples);
+    }
+
+    /*  The coverage check looks at every pixel, including kept ones  */
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, v->cover_fbo);
+    glViewport(0, 0, 1, 1);
+    glUseProgram(v->cover_prog);
+    glBindVertexArray(v->bounds_vao);
+    glBindTexture(GL_TEXTURE_2D, v->tex);
+    glUniform1i(glGetUniformLocation(v->cover_prog, "voronoi"), 0);
+    glUniform1i(glGetUniformLocation(v->cover_prog, "samples"), cfg->samples);
+    glUniform1i(glGetUniformLocation(v->cover_prog, "label_bits"),
+                config_label_bits(cfg));
+
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, v->cover_query);
+    glDrawArrays(GL_POINTS, 0, cfg->width * cfg->height);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    v->cover_pending = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, v->fbo);
+    glViewport(0, 0, cfg->width, cfg->height);
+    glUseProgram(v->prog);
+    glBindVertexArray(v->vao);
+    glUniform2f(glGetUniformLocation(v->prog, "scale"), cfg->sx, cfg->sy);
+    glUniform1i(glGetUniformLocation(v->prog, "label_bits"),
+                config_label_bits(cfg));
+
+    glBeginConditionalRender(v->cover_query, GL_QUERY_WAIT);
+    for (unsigned r=0; r < voronoi_regions(v); ++r)
+    {
+        voronoi_scissor(v, r);
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->resolution+2,
+                              cfg->samples);
+    }
+    glEndConditionalRender();
+}
+
+/*
+ *  Returns the number of labellings that fell back to the full cones
+ */
+unsigned voronoi_fallbacks(Voronoi* v)
+{
+    if (v->cover_pending)
+    {
+        GLuint missed;
+        glGetQueryObjectuiv(v->cover_query, GL_QUERY_RESULT, &missed);
+        v->fallbacks += (missed != 0);
+        v->cover_pending = false;
+    }
+    return v->fallbacks;
+}
+
+/*
+ *  Reduces the label texture to per-cell bounding boxes (in pixels)
+ */
+void voronoi_bounds_draw(Config* cfg, Voronoi* v)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, v->bounds_fbo);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, cfg->samples, 1);
+
+    const GLfloat empty[4] = {1e9f, 1e9f, 1e9f, 1e9f};
+    glClearBufferfv(GL_COLOR, 0, empty);
+
+    glUseProgram(v->bounds_prog);
+    glBindVertexArray(v->bounds_vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, v->tex);
+    glUniform1i(glGetUniformLocation(v->bounds_prog, "voronoi"), 0);
+    glUniform1i(glGetUniformLocation(v->bounds_prog, "samples"), cfg->samples);
+    glUniform1i(glGetUniformLocation(v->bounds_prog, "label_bits"),
+                config_label_bits(cfg));
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_MIN);
+    glDrawArrays(GL_POINTS, 0, cfg->width * cfg->height);
+    glBlendEquation(GL_FUNC_ADD);
+    glDisable(GL_BLEND);
+
+    teardown(viewport);
+}
+
+Voronoi* voronoi_new(Config* cfg, uint8_t* img)
+{
+    Voronoi* v = (Voronoi*)calloc(1, sizeof(Voronoi));
+    glGenVertexArrays(1, &v->vao);
+
+    glBindVertexArray(v->vao);
+        voronoi_cone_bind(cfg->resolution);         /* Uses bound VAO   */
+        v->pts = voronoi_instances(cfg);            /* (same) */
+    glBindVertexArray(0);
+
+    /*  Shaders that need the seeds that were used for the current         *
+     *  labelling read them from a copy, since pts is rewritten in place  */
+    glGenBuffers(1, &v->prev);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, v->prev);
+    glBufferData(GL_COPY_WRITE_BUFFER, 3 * sizeof(float) * cfg->samples,
+                 NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenTextures(1, &v->prev_tex);
+    glBindTexture(GL_TEXTURE_BUFFER, v->prev_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, v->prev);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    bool packed = (cfg->label != LABEL_CONES);
+    v->prog = program_link(
+        shader_compile(GL_VERTEX_SHADER, voronoi_vert_src),
+        shader_compile(GL_FRAGMENT_SHADER,
+                       packed ? voronoi_packed_frag_src : voronoi_frag_src));
+
+    v->tex   = texture_new();
+    v->img   = texture_new();
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, v->tex);
+    if (packed)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, cfg->width, cfg->height,
+                     0, GL_RED, GL_FLOAT, 0);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cfg->width, cfg->height,
+                     0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        v->depth = texture_new();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, cfg->width,
+                     cfg->height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+    }
     glBindTexture(GL_TEXTURE_2D, v->img);
-    glUniform1i(glGetUniformLocation(s->prog, "img"), 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, cfg->width, cfg->height,
+                 0, GL_RED, GL_UNSIGNED_BYTE, img);
+
+    glGenFramebuffers(1, &v->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, v->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, v->tex, 0);
+    if (!packed)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                               GL_TEXTURE_2D, v->depth, 0);
+    }
+    fbo_check("voronoi");
+
+    if (cfg->sum == SUM_BOXES || cfg->label == LABEL_QUADS)
+    {
+        voronoi_bounds_new(cfg, v);
+    }
+    if (cfg->label == LABEL_QUADS)
+    {
+        voronoi_quads_new(v);
+    }
+
+    teardown(NULL);
+    return v;
+}
+
+void voronoi_draw(Config* cfg, Voronoi* v)
+{
+    /*  The feedback pass falls back to (and relative sums are taken      *
+     *  from) these seeds, so they're copied even if nothing is redrawn   */
+    glBindBuffer(GL_COPY_READ_BUFFER, v->pts);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, v->prev);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        0, 0, 3 * sizeof(float) * cfg->samples);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    /*  With nothing to redraw, the labels (and bounds) stand  */
+    if (v->partial && !v->rect_count)
+    {
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, v->fbo);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, cfg->width, cfg->height);
+
+    glUseProgram(v->prog);
+    glBindVertexArray(v->vao);
+    glUniform2f(glGetUniformLocation(v->prog, "scale"), cfg->sx, cfg->sy);
+    glUniform1i(glGetUniformLocation(v->prog, "label_bits"),
+                config_label_bits(cfg));
+
+    if (cfg->label != LABEL_CONES)
+    {
+        /*  Clear to the largest finite float (0x7F7FFFFF), which decodes  *
+         *  to a label with all bits set (never a valid cell)              */
+        const GLfloat far[4] = {FLT_MAX, 0.0f, 0.0f, 0.0f};
+        for (unsigned r=0; r < voronoi_regions(v); ++r)
+        {
+            voronoi_scissor(v, r);
+            glClearBufferfv(GL_COLOR, 0, far);
+        }
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_MIN);
+        if (cfg->label == LABEL_QUADS)
+        {
+            voronoi_quads_draw(cfg, v);
+        }
+        else
+        {
+            for (unsigned r=0; r < voronoi_regions(v); ++r)
+            {
+                voronoi_scissor(v, r);
+                glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->resolution+2,
+                                      cfg->samples);
+            }
+        }
+        glBlendEquation(GL_FUNC_ADD);
+        glDisable(GL_BLEND);
+    }
+    else
+    {
+        glEnable(GL_DEPTH_TEST);
+        for (unsigned r=0; r < voronoi_regions(v); ++r)
+        {
+            voronoi_scissor(v, r);
+            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+            glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->resolution+2,
+                                  cfg->samples);
+        }
+    }
+    glDisable(GL_SCISSOR_TEST);
+
+    teardown(viewport);
+
+    if (v->bounds)
+    {
+        voronoi_bounds_draw(cfg, v);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*  Edge length (in pixels) of the tiles in the tile occupancy map, and   *
+ *  the number of columns between restarts of the row prefix sums      */
+#define SUM_TILE 16
+
+typedef struct Sum_
+{
+    GLuint prog;
+    GLuint fbo;
+    GLuint tex;
+    GLuint vao;
+    GLsizei rows;   /*  Height of tex  */
+
+    GLuint prefix;  /*  Row prefix sums of the density (SUM_SPANS)  */
+    GLuint tiles;   /*  Tile occupancy map (if skip_empty is set)   */
+    GLuint frozen;      /*  Per-seed frozen flags (if freeze is set)    */
+    GLuint frozen_tex;
+    const uint8_t* frozen_flags;    /*  The same flags, for SUM_SORT    */
+
+    /*  CPU buffers for the sort-and-segment engine (SUM_SORT)  */
+    uint8_t* labels;                /*  Label texture read back as RGB
+                                        (or as R32F, if packed)         */
+    struct SortRecord_* records[2]; /*  Ping-pong buffers for sorting   */
+    uint32_t (*hist)[256];          /*  Per-thread radix histograms     */
+    float (*sums)[4];               /*  Per-cell sums, uploaded to tex  */
+} Sum;
+
+/*
+ *  The sort-and-segment engine runs on the CPU:  it reads back the label
+ *  texture, emits one record per pixel, radix-sorts the records by label
+ *  (stably, so each cell's records stay in pixel order), then reduces each
+ *  run of equal labels in double precision.  The result doesn't depend on
+ *  the number of threads or on GPU scheduling, so it is reproducible.
+ */
+typedef struct SortRecord_
+{
+    uint32_t label;
+    float w, xw, yw;    /*  Weight, and weighted (normalized) position  */
+} SortRecord;
+
+typedef struct SortJob_
+{
+    const Config* cfg;
+    Sum* s;
+    SortRecord* src;    /*  Records to sort (for the radix passes)  */
+    SortRecord* dst;
+    unsigned shift;     /*  Bit offset of the current radix digit   */
+    int bits;           /*  Label bits, if labels are packed        */
+} SortJob;
+
+/*
+ *  Builds records for this thread's block of rows
+ */
+void sum_sort_records(void* data, unsigned t)
+{
+    SortJob* j = (SortJob*)data;
+    const Config* c = j->cfg;
+
+    unsigned y0 = c->height * t / c->threads;
+    unsigned y1 = c->height * (t + 1) / c->threads;
+    for (unsigned y=y0; y < y1; ++y)
+    {
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            size_t i = y * c->width + x;
+            uint32_t label;
+            if (c->label != LABEL_CONES)
+            {
+                memcpy(&label, &j->s->labels[i * 4], sizeof(label));
+                label = (label - 0x800000) & ((1u << j->bits) - 1);
+            }
+            else
+            {
+                const uint8_t* rgb = &j->s->labels[i * 3];
+                label = rgb[0] | (rgb[1] << 8) | (rgb[2] << 16);
+            }
+
+            float w = 0.01f + 0.99f * (1.0f - c->img[i] / 255.0f);
+            j->dst[i] = (SortRecord){
+                .label = label,
+                .w = w,
+                .xw = w * (x + 0.5f) / c->width,
+                .yw = w * (y + 0.5f) / c->height};
+        }
+    }
+}
+
+void sum_sort_histogram(void* data, unsigned t)
+{
+    SortJob* j = (SortJob*)data;
+    size_t n = (size_t)j->cfg->width * j->cfg->height;
+    size_t i0 = n * t / j->cfg->threads;
+    size_t i1 = n * (t + 1) / j->cfg->threads;
+
+    uint32_t* hist = j->s->hist[t];
+    memset(hist, 0, sizeof(j->s->hist[t]));
+    for (size_t i=i0; i < i1; ++i)
+    {
+        hist[(j->src[i].label >> j->shift) & 0xFF]++;
+    }
+}
+
+/*
+ *  Scatters this thread's block of records, where hist now holds the
+ *  thread's starting offset for each digit
+ */
+void sum_sort_scatter(void* data, unsigned t)
+{
+    SortJob* j = (SortJob*)data;
+    size_t n = (size_t)j->cfg->width * j->cfg->height;
+    size_t i0 = n * t / j->cfg->threads;
+    size_t i1 = n * (t + 1) / j->cfg->threads;
+
+    uint32_t* offset = j->s->hist[t];
+    for (size_t i=i0; i < i1; ++i)
+    {
+        j->dst[offset[(j->src[i].label >> j->shift) & 0xFF]++] = j->src[i];
+    }
+}
+
+/*
+ *  Returns the index of the first sorted record with a label >= l
+ */
+size_t sum_sort_find(const SortRecord* r, size_t n, uint32_t l)
+{
+    size_t lo = 0;
+    while (n)
+    {
+        size_t half = n / 2;
+        if (r[lo + half].label < l)
+        {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else
+        {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+/*
+ *  Reduces the segments for this thread's range of cells
+ */
+void sum_sort_reduce(void* data, unsigned t)
+{
+    SortJob* j = (SortJob*)data;
+    const Config* c = j->cfg;
+    size_t n = (size_t)c->width * c->height;
+
+    uint32_t l0 = c->samples * t / c->threads;
+    uint32_t l1 = c->samples * (t + 1) / c->threads;
+    size_t i = sum_sort_find(j->src, n, l0);
+
+    for (uint32_t l=l0; l < l1; ++l)
+    {
+        double w = 0, xw = 0, yw = 0;
+        size_t start = i;
+        if (j->s->frozen_flags && j->s->frozen_flags[l])
+        {
+            /*  Frozen cells are left empty, as in sum_frag_src  */
+            i = start + sum_sort_find(&j->src[start], n - start, l + 1);
+            start = i;
+        }
+        for (; i < n && j->src[i].label == l; ++i)
+        {
+            w += j->src[i].w;
+            xw += j->src[i].xw;
+            yw += j->src[i].yw;
+        }
+
+        /*  Same layout as sum_frag_src  */
+        j->s->sums[l][0] = xw;
+        j->s->sums[l][1] = yw;
+        j->s->sums[l][2] = i - start;
+        j->s->sums[l][3] = w;
+    }
+}
+
+/*
+ *  Runs the sort-and-segment engine, leaving per-cell sums in the single
+ *  row of the summation texture
+ */
+void sum_sort(Config* cfg, Voronoi* v, Sum* s)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, v->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (cfg->label != LABEL_CONES)
+    {
+        glReadPixels(0, 0, cfg->width, cfg->height, GL_RED, GL_FLOAT,
+                     s->labels);
+    }
+    else
+    {
+        glReadPixels(0, 0, cfg->width, cfg->height, GL_RGB, GL_UNSIGNED_BYTE,
+                     s->labels);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    SortJob j = {.cfg = cfg, .s = s, .dst = s->records[0],
+                 .bits = config_label_bits(cfg)};
+    parallel_for(cfg->threads, sum_sort_records, &j);
+
+    /*  LSD radix sort, one byte of the label at a time  */
+    for (j.shift=0; (cfg->samples - 1) >> j.shift; j.shift += 8)
+    {
+        j.src = j.dst;
+        j.dst = (j.src == s->records[0]) ? s->records[1] : s->records[0];
+        parallel_for(cfg->threads, sum_sort_histogram, &j);
+
+        uint32_t total = 0;
+        for (unsigned d=0; d < 256; ++d)
+        {
+            for (unsigned t=0; t < cfg->threads; ++t)
+            {
+                uint32_t count = s->hist[t][d];
+                s->hist[t][d] = total;
+                total += count;
+            }
+        }
+        parallel_for(cfg->threads, sum_sort_scatter, &j);
+    }
+
+    j.src = j.dst;
+    parallel_for(cfg->threads, sum_sort_reduce, &j);
+
+    glBindTexture(GL_TEXTURE_2D, s->tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cfg->samples, 1,
+                    GL_RGBA, GL_FLOAT, s->sums);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/*
+ *  Builds an RG32F texture holding running sums of weight and
+ *  (normalized x) * weight along each row of the image.  The sums restart
+ *  every SUM_TILE columns, so that the differences taken by spans_vert_src
+ *  stay small and don't cancel on long rows.  The image is static, so this
+ *  only happens once.
+ */
+GLuint sum_prefix(const Config* c)
+{
+    float (*buf)[2] = (float (*)[2])malloc(
+            sizeof(float) * 2 * c->width * c->height);
+
+    for (unsigned y=0; y < c->height; ++y)
+    {
+        double w = 0, xw = 0;
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            if (x % SUM_TILE == 0)
+            {
+                w = 0;
+                xw = 0;
+            }
+            size_t i = y * c->width + x;
+            double weight = 0.01 + 0.99 * (1.0 - c->img[i] / 255.0);
+            w += weight;
+            xw += weight * (x + 0.5) / c->width;
+            buf[i][0] = w;
+            buf[i][1] = xw;
+        }
+    }
+
+    GLuint tex = texture_new();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, c->width, c->height,
+                 0, GL_RG, GL_FLOAT, buf);
+    free(buf);
+    return tex;
+}
+
+/*
+ *  Builds the tile occupancy map:  one RG32F texel per SUM_TILE-square
+ *  tile of the image, holding 1 in red if the tile's darkest pixel is
+ *  below the threshold (and 0 otherwise), and the tile's mean stipple
+ *  weight in green.  Prints the fraction of tiles that are empty.
+ */
+GLuint sum_tiles(const Config* c)
+{
+    unsigned tw = (c->width + SUM_TILE - 1) / SUM_TILE;
+    unsigned th = (c->height + SUM_TILE - 1) / SUM_TILE;
+    float (*buf)[2] = (float (*)[2])malloc(sizeof(float) * 2 * tw * th);
+
+    unsigned empty = 0;
+    for (unsigned ty=0; ty < th; ++ty)
+    {
+        for (unsigned tx=0; tx < tw; ++tx)
+        {
+            double w = 0;
+            uint8_t darkest = 255;
+            unsigned n = 0;
+            for (unsigned y=ty * SUM_TILE;
+                 y < (ty + 1) * SUM_TILE && y < c->height; ++y)
+            {
+                for (unsigned x=tx * SUM_TILE;
+                     x < (tx + 1) * SUM_TILE && x < c->width; ++x)
+                {
+                    uint8_t p = c->img[y * c->width + x];
+                    darkest = (p < darkest) ? p : darkest;
+                    w += 0.01 + 0.99 * (1.0 - p / 255.0);
+                    n++;
+                }
+            }
+
+            float* t = buf[ty * tw + tx];
+            t[0] = (1.0f - darkest / 255.0f < c->skip_empty) ? 1.0f : 0.0f;
+            t[1] = w / n;
+            empty += (t[0] != 0.0f);
+        }
+    }
+    fprintf(stderr, "Empty tiles: %u of %u (%.1f%%)\n",
+            empty, tw * th, 100.0 * empty / (tw * th));
+
+    GLuint tex = texture_new();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, tw, th, 0, GL_RG, GL_FLOAT, buf);
+    free(buf);
+    return tex;
+}
+
+Sum* sum_new(Config* config)
+{
+    Sum* sum = (Sum*)calloc(1, sizeof(Sum));
+
+    /*  Each texel holds the sums for a block of image rows, except with  *
+     *  the sort engine, which reduces each cell to one texel on the CPU   */
+    sum->rows = (config->sum == SUM_SORT)
+        ? 1 : (config->height + config->sum_rows - 1) / config->sum_rows;
+
+    /*  Seed-relative half-precision sums are only used when the pixel    *
+     *  counts per texel stay exactly representable (below 2048), which   *
+     *  is estimated from the block height and the mean cell width        */
+    if (config->sum_half)
+    {
+        double cell = sqrt((double)config->width * config->height /
+                           config->samples);
+        if (config->sum == SUM_SORT || 2 * cell * config->sum_rows >= 2048)
+        {
+            fprintf(stderr, "Warning: half-precision sums would lose "
+                            "precision here; using 32-bit floats\n");
+            config->sum_half = false;
+        }
+    }
+
+    GLenum format = config->sum_half ? GL_RGBA16F : GL_RGBA32F;
+    size_t texel = config->sum_half ? 8 : 16;
+    fprintf(stderr, "Summation texture: %u x %i %s (%.1f MB)\n",
+            config->samples, sum->rows,
+            config->sum_half ? "RGBA16F" : "RGBA32F",
+            texel * config->samples * sum->rows / (1024.0 * 1024.0));
+
+    sum->tex = texture_new();
+    glBindTexture(GL_TEXTURE_2D, sum->tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, config->samples,
+                     sum->rows, 0, GL_RGBA, GL_FLOAT, 0);
+
+    glGenFramebuffers(1, &sum->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, sum->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, sum->tex, 0);
+    fbo_check("sum");
+
+    if (config->sum == SUM_SPANS)
+    {
+        /*  Points are generated from gl_VertexID, so the VAO is empty  */
+        glGenVertexArrays(1, &sum->vao);
+        sum->prefix = sum_prefix(config);
+        sum->prog = program_link(
+            shader_compile(GL_VERTEX_SHADER, spans_vert_src),
+            shader_compile(GL_FRAGMENT_SHADER, spans_frag_src));
+    }
+    else if (config->sum == SUM_BOXES)
+    {
+        sum->vao = quad_new();
+        sum->tiles = config->skip_empty ? sum_tiles(config) : 0;
+        sum->prog = program_link(
+            shader_compile(GL_VERTEX_SHADER, boxes_vert_src),
+            shader_compile(GL_FRAGMENT_SHADER, boxes_frag_src));
+    }
+    else if (config->sum == SUM_SORT)
+    {
+        size_t pixels = (size_t)config->width * config->height;
+        sum->labels = (uint8_t*)malloc(pixels * 4);
+        sum->records[0] = (SortRecord*)malloc(pixels * sizeof(SortRecord));
+        sum->records[1] = (SortRecord*)malloc(pixels * sizeof(SortRecord));
+        sum->hist = (uint32_t (*)[256])malloc(
+                config->threads * sizeof(*sum->hist));
+        sum->sums = (float (*)[4])malloc(config->samples * sizeof(*sum->sums));
+    }
+    else
+    {
+        sum->vao = quad_new();
+        sum->tiles = config->skip_empty ? sum_tiles(config) : 0;
+        sum->prog = program_link(
+            shader_compile(GL_VERTEX_SHADER, quad_vert_src),
+            shader_compile(GL_FRAGMENT_SHADER, sum_frag_src));
+    }
+
+    if (config->freeze)
+    {
+        glGenBuffers(1, &sum->frozen);
+        glBindBuffer(GL_TEXTURE_BUFFER, sum->frozen);
+        glBufferData(GL_TEXTURE_BUFFER, config->samples, NULL,
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &sum->frozen_tex);
+        glBindTexture(GL_TEXTURE_BUFFER, sum->frozen_tex);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R8UI, sum->frozen);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    teardown(NULL);
+    return sum;
+}
+
+/*
+ *  Frees the CPU side of the summation stage (its GL objects go with the
+ *  context)
+ */
+void sum_free(Sum* s)
+{
+    free(s->labels);
+    free(s->records[0]);
+    free(s->records[1]);
+    free(s->hist);
+    free(s->sums);
+    free(s);
+}
+
+/*
+ *  Uploads one flag per seed, marking the cells that sum_draw should skip
+ */
+void sum_freeze(Config* cfg, Sum* s, const uint8_t* frozen)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, s->frozen);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, cfg->samples, frozen);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    s->frozen_flags = frozen;
+}
+
+void sum_draw(Config* cfg, Voronoi* v, Sum* s)
+{
+    if (cfg->sum == SUM_SORT)
+    {
+        sum_sort(cfg, v, s);
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s->fbo);
+
+    // Save viewport size and restore it later
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, cfg->samples, s->rows);
+
+    /*  Partial sums may be blended, so start from zero rather than the   *
+     *  clear color (which has alpha = 1)                                 */
+    const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+
+    glUseProgram(s->prog);
+    glBindVertexArray(s->vao);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, v->tex);
+    glUniform1i(glGetUniformLocation(s->prog, "voronoi"), 0);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, v->prev_tex);
+    glUniform1i(glGetUniformLocation(s->prog, "seeds"), 3);
+    glUniform1i(glGetUniformLocation(s->prog, "relative"), cfg->sum_half);
+    glUniform1i(glGetUniformLocation(s->prog, "block"), cfg->sum_rows);
+    glUniform1i(glGetUniformLocation(s->prog, "rows"), s->rows);
+    glUniform1i(glGetUniformLocation(s->prog, "label_bits"),
+                config_label_bits(cfg));
+
+    /*  During the early subsampled iterations, the fraction of columns   *
+     *  that are summed ramps up from 1/8 to 1                            */
+    int stride = 1;
+    if (cfg->step < cfg->subsample)
+    {
+        float fraction = 0.125f + 0.875f * cfg->step / cfg->subsample;
+        stride = (int)roundf(1.0f / fraction);
+    }
+    glUniform1i(glGetUniformLocation(s->prog, "stride"), stride);
+    glUniform1i(glGetUniformLocation(s->prog, "phase"), cfg->step);
+
+    /*  The tile map goes on unit 4 (the full and boxes engines only)  */
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, s->tiles);
+    glUniform1i(glGetUniformLocation(s->prog, "tiles"), 4);
+    glUniform1i(glGetUniformLocation(s->prog, "tile"),
+                s->tiles ? SUM_TILE : 0);
+
+    /*  Frozen flags go on unit 5  */
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, s->frozen_tex);
+    glUniform1i(glGetUniformLocation(s->prog, "frozen"), 5);
+    glUniform1i(glGetUniformLocation(s->prog, "freeze"), s->frozen_tex != 0);
+
+    if (cfg->sum == SUM_SPANS)
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, s->prefix);
+        glUniform1i(glGetUniformLocation(s->prog, "prefix"), 1);
+        glUniform1i(glGetUniformLocation(s->prog, "prefix_tile"), SUM_TILE);
+        glUniform1i(glGetUniformLocation(s->prog, "samples"), cfg->samples);
+
+        /*  Cells are convex, so there's normally one span per cell and    *
+         *  row; blending catches any extra spans from rasterization error */
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glDrawArrays(GL_POINTS, 0, cfg->width * cfg->height);
+        glDisable(GL_BLEND);
+    }
+    else if (cfg->sum == SUM_BOXES)
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, v->img);
+        glUniform1i(glGetUniformLocation(s->prog, "img"), 1);
+
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, v->bounds);
+        glUniform1i(glGetUniformLocation(s->prog, "bounds"), 2);
+        glUniform1i(glGetUniformLocation(s->prog, "samples"), cfg->samples);
+
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, cfg->samples);
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, v->img);
+        glUniform1i(glGetUniformLocation(s->prog, "img"), 1);
+
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+    teardown(viewport);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct Feedback_
+{
+    GLuint vao;
+    GLuint prog;
+    GLuint cells;   /*  Each cell's mass and pixel count, if captured  */
+} Feedback;
+
+GLuint feedback_indices(uint16_t samples)
+{
+    GLuint vao;
+    GLuint vbo;
+    size_t bytes = sizeof(GLuint) * samples;
+    GLuint* indices = (GLuint*)malloc(bytes);
+
+    for (uint16_t i=0; i < samples; ++i)
+    {
+        indices[i] = i;
+    }
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, bytes, indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, 0);
+    glBindVertexArray(0);
+
+    free(indices);
+
+    return vao;
+}
+
+Feedback* feedback_new(GLuint samples, bool cells)
+{
+    Feedback* f = (Feedback*)calloc(1, sizeof(Feedback));
+
+    f->prog = glCreateProgram();
+    GLuint shader = shader_compile(GL_VERTEX_SHADER, feedback_src);
+    glAttachShader(f->prog, shader);
+    const GLchar* varying[] = { "pos", "cell" };
+    glTransformFeedbackVaryings(f->prog, cells ? 2 : 1, varying,
+                                GL_SEPARATE_ATTRIBS);
+    glLinkProgram(f->prog);
+    program_check(f->prog);
+
+    f->vao = feedback_indices(samples);
+
+    /*  Cell masses are captured into a second buffer, for reseeding  */
+    if (cells)
+    {
+        glGenBuffers(1, &f->cells);
+        glBindBuffer(GL_ARRAY_BUFFER, f->cells);
+        glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(float) * samples,
+                     NULL, GL_STREAM_READ);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    return f;
+}
+
+void feedback_draw(Config* cfg, Voronoi* v, Sum* s, Feedback* f)
+{
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(f->vao);
+    glUseProgram(f->prog);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, s->tex);
+    glUniform1i(glGetUniformLocation(f->prog, "summed"), 0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, v->prev_tex);
+    glUniform1i(glGetUniformLocation(f->prog, "seeds"), 1);
+    glUniform1i(glGetUniformLocation(f->prog, "relative"), cfg->sum_half);
+
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, s->frozen_tex);
+    glUniform1i(glGetUniformLocation(f->prog, "frozen"), 5);
+    glUniform1i(glGetUniformLocation(f->prog, "freeze"), s->frozen_tex != 0);
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, v->pts);
+    if (f->cells)
+    {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 1, f->cells);
+    }
+
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, cfg->samples);
+    glEndTransformFeedback();
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    teardown(NULL);
+}
+
+/******************************************************************************/
+
+/*
+ *  Felzenszwalb-Huttenlocher labelling:  a Euclidean nearest-seed labelling
+ *  of the pixel grid in two separable passes, whose cost doesn't depend on
+ *  the number of seeds.  Seeds are bucketed by pixel column.  The column
+ *  pass finds the nearest of each column's seeds to every pixel center in
+ *  that column, then the row pass takes the lower envelope of the parabolas
+ *  (x - sx)^2 + dy^2 that those seeds define along each row.  This is exact
+ *  for seeds at pixel centers; with sub-pixel seeds, two seeds in the same
+ *  column are ranked at the column's center, which can flip pixels within
+ *  a fraction of a pixel of a tie.
+ */
+typedef struct Fh_
+{
+    const Config* cfg;
+    const float (*pts)[3];  /*  Seeds being labelled                    */
+
+    uint32_t* labels;       /*  Nearest seed of each pixel              */
+    int32_t* nearest;       /*  Nearest seed in each pixel's column     */
+    float* dy2;             /*  Squared vertical distance to that seed  */
+
+    uint32_t* row_start;    /*  Bucket offsets for seeds by row (h + 1) */
+    uint32_t* col_start;    /*  Bucket offsets for seeds by column      */
+    uint32_t* by_row;       /*  Seed indices sorted by row              */
+    uint32_t* by_col;       /*  Seed indices sorted by column, then row */
+
+    /*  Per-thread scratch space, n entries each:  enough for a row,   *
+     *  a column, or every seed (which may all share a pixel column)   */
+    size_t n;
+    double* center;         /*  Parabola vertices                       */
+    double* height;         /*  Parabola offsets                        */
+    uint32_t* index;        /*  Parabola sources (seeds or columns)     */
+    uint32_t* env;          /*  Parabolas in the lower envelope         */
+    double* z;              /*  Envelope boundaries (n + 1 entries)     */
+    uint32_t* out;          /*  Lowest parabola at each pixel center    */
+} Fh;
+
+Fh* fh_new(const Config* c)
+{
+    Fh* fh = (Fh*)calloc(1, sizeof(Fh));
+    size_t pixels = (size_t)c->width * c->height;
+    size_t n = c->width > c->height ? c->width : c->height;
+    n = (n > c->samples ? n : c->samples) + 1;
+
+    fh->cfg = c;
+    fh->n = n;
+    fh->labels = (uint32_t*)malloc(pixels * sizeof(uint32_t));
+    fh->nearest = (int32_t*)malloc(pixels * sizeof(int32_t));
+    fh->dy2 = (float*)malloc(pixels * sizeof(float));
+    fh->row_start = (uint32_t*)malloc((c->height + 1) * sizeof(uint32_t));
+    fh->col_start = (uint32_t*)malloc((c->width + 1) * sizeof(uint32_t));
+    fh->by_row = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+    fh->by_col = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+
+    fh->center = (double*)malloc(c->threads * n * sizeof(double));
+    fh->height = (double*)malloc(c->threads * n * sizeof(double));
+    fh->index = (uint32_t*)malloc(c->threads * n * sizeof(uint32_t));
+    fh->env = (uint32_t*)malloc(c->threads * n * sizeof(uint32_t));
+    fh->z = (double*)malloc(c->threads * n * sizeof(double));
+    fh->out = (uint32_t*)malloc(c->threads * n * sizeof(uint32_t));
+    return fh;
+}
+
+void fh_free(Fh* fh)
+{
+    free(fh->labels);
+    free(fh->nearest);
+    free(fh->dy2);
+    free(fh->row_start);
+    free(fh->col_start);
+    free(fh->by_row);
+    free(fh->by_col);
+    free(fh->center);
+    free(fh->height);
+    free(fh->index);
+    free(fh->env);
+    free(fh->z);
+    free(fh->out);
+    free(fh);
+}
+
+/*
+ *  Returns the pixel column or row (clamped to the image) holding a seed
+ *  coordinate in the 0 to 1 range
+ */
+static unsigned fh_bucket(float p, unsigned size)
+{
+    int i = (int)(p * size);
+    return i < 0 ? 0 : ((unsigned)i >= size ? size - 1 : (unsigned)i);
+}
+
+/*
+ *  Finds the lower envelope of n > 0 parabolas (p - center)^2 + height,
+ *  given in order of increasing center, and writes the index (0 to n - 1)
+ *  of the lowest one at each pixel center p = i + 0.5 for i < size.
+ *  Ties go to the earlier parabola.
+ */
+static void fh_envelope(const double* center, const double* height,
+                        unsigned n, unsigned size,
+                        uint32_t* env, double* z, uint32_t* out)
+{
+    int k = -1;
+    for (unsigned j=0; j < n; ++j)
+    {
+        const double q = center[j];
+        const double fq = height[j] + q * q;
+
+        double s = -INFINITY;
+        while (k >= 0)
+        {
+            const double p = center[env[k]];
+            const double fp = height[env[k]] + p * p;
+            if (q == p)
+            {
+                s = (fq < fp) ? -INFINITY : INFINITY;
+            }
+            else
+            {
+                s = (fq - fp) / (2 * (q - p));
+            }
+
+            if (s > z[k])
+            {
+                break;
+            }
+            s = -INFINITY;
+            k--;
+        }
+
+        /*  A parabola that never gets below the envelope is skipped  */
+        if (s == INFINITY)
+        {
+            continue;
+        }
+        env[++k] = j;
+        z[k] = s;
+    }
+    z[k + 1] = INFINITY;
+
+    k = 0;
+    for (unsigned i=0; i < size; ++i)
+    {
+        while (z[k + 1] < i + 0.5)
+        {
+            k++;
+        }
+        out[i] = env[k];
+    }
+}
+
+/*
+ *  Column pass for this thread's block of columns
+ */
+void fh_columns(void* data, unsigned t)
+{
+    Fh* fh = (Fh*)data;
+    const Config* c = fh->cfg;
+    const size_t n = fh->n;
+    double* center = &fh->center[t * n];
+    double* height = &fh->height[t * n];
+    uint32_t* out = &fh->out[t * n];
+
+    unsigned x0 = c->width * t / c->threads;
+    unsigned x1 = c->width * (t + 1) / c->threads;
+    for (unsigned x=x0; x < x1; ++x)
+    {
+        const uint32_t* seeds = &fh->by_col[fh->col_start[x]];
+        unsigned m = fh->col_start[x + 1] - fh->col_start[x];
+        if (m == 0)
+        {
+            for (unsigned y=0; y < c->height; ++y)
+            {
+                fh->nearest[(size_t)y * c->width + x] = -1;
+            }
+            continue;
+        }
+
+        /*  Seeds are sorted by row, and ranked at the column's center  */
+        for (unsigned j=0; j < m; ++j)
+        {
+            double dx = fh->pts[seeds[j]][0] * c->width - (x + 0.5);
+            center[j] = fh->pts[seeds[j]][1] * c->height;
+            height[j] = dx * dx;
+        }
+        fh_envelope(center, height, m, c->height,
+                    &fh->env[t * n], &fh->z[t * n], out);
+
+        for (unsigned y=0; y < c->height; ++y)
+        {
+            size_t i = (size_t)y * c->width + x;
+            double dy = center[out[y]] - (y + 0.5);
+            fh->nearest[i] = seeds[out[y]];
+            fh->dy2[i] = dy * dy;
+        }
+    }
+}
+
+/*
+ *  Row pass for this thread's block of rows
+ */
+void fh_rows(void* data, unsigned t)
+{
+    Fh* fh = (Fh*)data;
+    const Config* c = fh->cfg;
+    const size_t n = fh->n;
+    double* center = &fh->center[t * n];
+    double* height = &fh->height[t * n];
+    uint32_t* index = &fh->index[t * n];
+    uint32_t* out = &fh->out[t * n];
+
+    unsigned y0 = c->height * t / c->threads;
+    unsigned y1 = c->height * (t + 1) / c->threads;
+    for (unsigned y=y0; y < y1; ++y)
+    {
+        const size_t row = (size_t)y * c->width;
+
+        /*  One parabola per column that has a seed, which are already  *
+         *  in order of their vertex                                    */
+        unsigned m = 0;
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            if (fh->nearest[row + x] >= 0)
+            {
+                center[m] = fh->pts[fh->nearest[row + x]][0] * c->width;
+                height[m] = fh->dy2[row + x];
+                index[m++] = fh->nearest[row + x];
+            }
+        }
+        fh_envelope(center, height, m, c->width,
+                    &fh->env[t * n], &fh->z[t * n], out);
+
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            fh->labels[row + x] = index[out[x]];
+        }
+    }
+}
+
+/*
+ *  Labels every pixel with its nearest seed, leaving results in fh->labels
+ */
+void fh_label(Fh* fh, const float (*pts)[3])
+{
+    const Config* c = fh->cfg;
+    fh->pts = pts;
+
+    /*  Bucket the seeds by row, then (stably) by column, so that each    *
+     *  column's seeds are sorted by row                                  */
+    memset(fh->row_start, 0, (c->height + 1) * sizeof(uint32_t));
+    memset(fh->col_start, 0, (c->width + 1) * sizeof(uint32_t));
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        fh->row_start[fh_bucket(pts[i][1], c->height) + 1]++;
+        fh->col_start[fh_bucket(pts[i][0], c->width) + 1]++;
+    }
+    for (unsigned y=0; y < c->height; ++y)
+    {
+        fh->row_start[y + 1] += fh->row_start[y];
+    }
+    for (unsigned x=0; x < c->width; ++x)
+    {
+        fh->col_start[x + 1] += fh->col_start[x];
+    }
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        fh->by_row[fh->row_start[fh_bucket(pts[i][1], c->height)]++] = i;
+    }
+    for (unsigned j=0; j < c->samples; ++j)
+    {
+        unsigned i = fh->by_row[j];
+        fh->by_col[fh->col_start[fh_bucket(pts[i][0], c->width)]++] = i;
+    }
+
+    /*  Filling the buckets advanced each offset to the next bucket's,    *
+     *  so shift the column offsets back into place                       */
+    memmove(&fh->col_start[1], fh->col_start, c->width * sizeof(uint32_t));
+    fh->col_start[0] = 0;
+
+    parallel_for(c->threads, fh_columns, fh);
+    parallel_for(c->threads, fh_rows, fh);
+}
+
+/*
+ *  Reads the GPU's label texture back into an array of cell indices
+ */
+void voronoi_labels(const Config* cfg, Voronoi* v, uint32_t* out)
+{
+    size_t pixels = (size_t)cfg->width * cfg->height;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, v->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    if (cfg->label != LABEL_CONES)
+    {
+        uint32_t mask = (1u << config_label_bits(cfg)) - 1;
+        glReadPixels(0, 0, cfg->width, cfg->height, GL_RED, GL_FLOAT, out);
+        for (size_t i=0; i < pixels; ++i)
+        {
+            out[i] = (out[i] - 0x800000) & mask;
+        }
+    }
+    else
+    {
+        uint8_t* rgb = (uint8_t*)malloc(pixels * 3);
+        glReadPixels(0, 0, cfg->width, cfg->height, GL_RGB, GL_UNSIGNED_BYTE,
+                     rgb);
+        for (size_t i=0; i < pixels; ++i)
+        {
+            out[i] = rgb[3*i] | (rgb[3*i + 1] << 8) | (rgb[3*i + 2] << 16);
+        }
+        free(rgb);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+/*
+ *  Labels the seeds that the GPU last labelled (from v->prev) on the CPU,
+ *  returning the fraction of pixels where the two labellings disagree
+ */
+double voronoi_validate(const Config* cfg, Voronoi* v, Fh* fh)
+{
+    size_t pixels = (size_t)cfg->width * cfg->height;
+    size_t bytes = 3 * sizeof(float) * cfg->samples;
+    float (*pts)[3] = (float (*)[3])malloc(bytes);
+    glBindBuffer(GL_ARRAY_BUFFER, v->prev);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    uint32_t* gpu = (uint32_t*)malloc(pixels * sizeof(uint32_t));
+    voronoi_labels(cfg, v, gpu);
+    fh_label(fh, (const float (*)[3])pts);
+
+    size_t differ = 0;
+    for (size_t i=0; i < pixels; ++i)
+    {
+        differ += (gpu[i] != fh->labels[i]);
+    }
+
+    free(gpu);
+    free(pts);
+    return (double)differ / pixels;
+}
+
+/******************************************************************************/
+
+/*
+ *  The grid backend labels pixels by bucketing seeds into a uniform grid,
+ *  with about two seeds per bucket.  Each bucket's rectangle of pixels is
+ *  a tile:  searching outward ring by ring from the tile finds every seed
+ *  that could be nearest to one of its pixels, and each pixel then checks
+ *  only those candidates.  Seeds move a fraction of a cell per iteration,
+ *  so the buckets are updated in place, moving only the seeds that changed
+ *  bucket.
+ */
+typedef struct GridBucket_
+{
+    uint32_t* seeds;
+    uint32_t count, cap;
+} GridBucket;
+
+/*
+ *  Row kernels for the grid labeller:  each labels the pixels x0 to x1 - 1
+ *  of one row, given its candidates as structures of arrays (x position in
+ *  pixels, squared vertical distance to the row, and seed index).  Ties go
+ *  to the lower seed index, so every kernel gives the same labels.  The
+ *  vector kernels label 4, 8 or 16 pixels at a time, finishing the row
+ *  with the scalar kernel.
+ */
+typedef void (*GridRow)(const float* cx, const float* dy2, const uint32_t* ci,
+                        unsigned m, unsigned x0, unsigned x1, uint32_t* out);
+
+static void grid_row_scalar(const float* cx, const float* dy2,
+                            const uint32_t* ci, unsigned m,
+                            unsigned x0, unsigned x1, uint32_t* out)
+{
+    for (unsigned x=x0; x < x1; ++x)
+    {
+        const float fx = x + 0.5f;
+        float best = INFINITY;
+        uint32_t label = 0;
+        for (unsigned j=0; j < m; ++j)
+        {
+            const float dx = cx[j] - fx;
+            const float d = dx * dx + dy2[j];
+            if (d < best || (d == best && ci[j] < label))
+            {
+                best = d;
+                label = ci[j];
+            }
+        }
+        out[x - x0] = label;
+    }
+}
+
+#if GRID_SIMD
+__attribute__((target("sse4.1")))
+static void grid_row_sse4(const float* cx, const float* dy2,
+                          const uint32_t* ci, unsigned m,
+                          unsigned x0, unsigned x1, uint32_t* out)
+{
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    unsigned x = x0;
+    for (; x + 4 <= x1; x += 4)
+    {
+        const __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), lane);
+        __m128 best = _mm_set1_ps(INFINITY);
+        __m128i label = _mm_setzero_si128();
+        for (unsigned j=0; j < m; ++j)
+        {
+            const __m128 dx = _mm_sub_ps(_mm_set1_ps(cx[j]), fx);
+            const __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx),
+                                        _mm_set1_ps(dy2[j]));
+            const __m128i i = _mm_set1_epi32(ci[j]);
+            const __m128 take = _mm_or_ps(_mm_cmplt_ps(d, best),
+                    _mm_and_ps(_mm_cmpeq_ps(d, best),
+                               _mm_castsi128_ps(_mm_cmpgt_epi32(label, i))));
+            best = _mm_blendv_ps(best, d, take);
+            label = _mm_castps_si128(_mm_blendv_ps(
+                    _mm_castsi128_ps(label), _mm_castsi128_ps(i), take));
+        }
+        _mm_storeu_si128((__m128i*)&out[x - x0], label);
+    }
+    grid_row_scalar(cx, dy2, ci, m, x, x1, &out[x - x0]);
+}
+
+__attribute__((target("avx2")))
+static void grid_row_avx2(const float* cx, const float* dy2,
+                          const uint32_t* ci, unsigned m,
+                          unsigned x0, unsigned x1, uint32_t* out)
+{
+    const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f,
+                                       4.5f, 5.5f, 6.5f, 7.5f);
+    unsigned x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        const __m256 fx = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+        __m256 best = _mm256_set1_ps(INFINITY);
+        __m256i label = _mm256_setzero_si256();
+        for (unsigned j=0; j < m; ++j)
+        {
+            const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(cx[j]), fx);
+            const __m256 d = _mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                           _mm256_set1_ps(dy2[j]));
+            const __m256i i = _mm256_set1_epi32(ci[j]);
+            const __m256 take = _mm256_or_ps(
+                    _mm256_cmp_ps(d, best, _CMP_LT_OQ),
+                    _mm256_and_ps(_mm256_cmp_ps(d, best, _CMP_EQ_OQ),
+                        _mm256_castsi256_ps(_mm256_cmpgt_epi32(label, i))));
+            best = _mm256_blendv_ps(best, d, take);
+            label = _mm256_castps_si256(_mm256_blendv_ps(
+                    _mm256_castsi256_ps(label), _mm256_castsi256_ps(i), take));
+        }
+        _mm256_storeu_si256((__m256i*)&out[x - x0], label);
+    }
+    grid_row_scalar(cx, dy2, ci, m, x, x1, &out[x - x0]);
+}
+
+__attribute__((target("avx512f")))
+static void grid_row_avx512(const float* cx, const float* dy2,
+                            const uint32_t* ci, unsigned m,
+                            unsigned x0, unsigned x1, uint32_t* out)
+{
+    const __m512 lane = _mm512_setr_ps(0.5f, 1.5f, 2.5f, 3.5f,
+                                       4.5f, 5.5f, 6.5f, 7.5f,
+                                       8.5f, 9.5f, 10.5f, 11.5f,
+                                       12.5f, 13.5f, 14.5f, 15.5f);
+    unsigned x = x0;
+    for (; x + 16 <= x1; x += 16)
+    {
+        const __m512 fx = _mm512_add_ps(_mm512_set1_ps((float)x), lane);
+        __m512 best = _mm512_set1_ps(INFINITY);
+        __m512i label = _mm512_setzero_si512();
+        for (unsigned j=0; j < m; ++j)
+        {
+            const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(cx[j]), fx);
+            const __m512 d = _mm512_add_ps(_mm512_mul_ps(dx, dx),
+                                           _mm512_set1_ps(dy2[j]));
+            const __m512i i = _mm512_set1_epi32(ci[j]);
+            const __mmask16 take = _mm512_cmp_ps_mask(d, best, _CMP_LT_OQ) |
+                    (_mm512_cmp_ps_mask(d, best, _CMP_EQ_OQ) &
+                     _mm512_cmpgt_epi32_mask(label, i));
+            best = _mm512_mask_mov_ps(best, take, d);
+            label = _mm512_mask_mov_epi32(label, take, i);
+        }
+        _mm512_storeu_si512(&out[x - x0], label);
+    }
+    grid_row_scalar(cx, dy2, ci, m, x, x1, &out[x - x0]);
+}
+#endif
+
+typedef struct Grid_
+{
+    const Config* cfg;
+    const float (*pts)[3];  /*  Seeds being labelled                    */
+    unsigned gx, gy;        /*  Grid size, in buckets                   */
+    GridBucket* buckets;
+    uint32_t* bucket;       /*  Bucket holding each seed                */
+    uint32_t* slot;         /*  Seed's position within its bucket       */
+
+    double (*sums)[4];      /*  Output: per-thread sums, in the layout  *
+                             *  of the summation texture                */
+
+    GridRow row;            /*  Row kernel for this CPU                 */
+    const char* kernel;     /*  And its name                            */
+    const uint8_t* frozen;  /*  Cells to skip, or NULL                  */
+    double weight[256];     /*  Stipple weight of each pixel value      */
+
+    /*  Per-thread candidate lists, samples entries each  */
+    float* cx;              /*  Candidate positions (in pixels)         */
+    float* cy;
+    float* cmin;            /*  Squared distance to the tile            */
+    float* dy2;             /*  Squared vertical distance to a row      */
+    uint32_t* ci;           /*  Candidate seed indices                  */
+    uint32_t* labels;       /*  Per-thread row of labels (width each)   */
+} Grid;
+
+Grid* grid_new(const Config* c, double (*sums)[4])
+{
+    Grid* g = (Grid*)calloc(1, sizeof(Grid));
+    g->cfg = c;
+    g->sums = sums;
+
+    /*  Roughly square buckets, about two seeds each  */
+    double gx = sqrt(c->samples / 2.0 * c->width / c->height);
+    g->gx = gx < 1 ? 1 : (unsigned)round(gx);
+    g->gy = (unsigned)round(c->samples / 2.0 / g->gx);
+    g->gy = g->gy < 1 ? 1 : g->gy;
+
+    g->buckets = (GridBucket*)calloc(g->gx * g->gy, sizeof(GridBucket));
+    g->bucket = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+    g->slot = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        g->bucket[i] = UINT32_MAX;
+    }
+
+    const size_t n = (size_t)c->threads * c->samples;
+    g->cx = (float*)malloc(n * sizeof(float));
+    g->cy = (float*)malloc(n * sizeof(float));
+    g->cmin = (float*)malloc(n * sizeof(float));
+    g->dy2 = (float*)malloc(n * sizeof(float));
+    g->ci = (uint32_t*)malloc(n * sizeof(uint32_t));
+    g->labels = (uint32_t*)malloc(c->threads * c->width * sizeof(uint32_t));
+
+    for (unsigned v=0; v < 256; ++v)
+    {
+        g->weight[v] = 0.01 + 0.99 * (1.0 - v / 255.0);
+    }
+
+    /*  Pick the widest row kernel this CPU supports  */
+    const char* kernel = "scalar";
+    g->row = grid_row_scalar;
+#if GRID_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        kernel = "avx512";
+        g->row = grid_row_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        kernel = "avx2";
+        g->row = grid_row_avx2;
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+    {
+        kernel = "sse4";
+        g->row = grid_row_sse4;
+    }
+#endif
+    g->kernel = kernel;
+    return g;
+}
+
+void grid_free(Grid* g)
+{
+    for (unsigned b=0; b < g->gx * g->gy; ++b)
+    {
+        free(g->buckets[b].seeds);
+    }
+    free(g->buckets);
+    free(g->bucket);
+    free(g->slot);
+    free(g->cx);
+    free(g->cy);
+    free(g->cmin);
+    free(g->dy2);
+    free(g->ci);
+    free(g->labels);
+    free(g);
+}
+
+/*
+ *  Empties every bucket, so that the next update files all of the seeds
+ *  afresh (needed once they have been renumbered)
+ */
+static void grid_reset(Grid* g)
+{
+    for (unsigned b=0; b < g->gx * g->gy; ++b)
+    {
+        g->buckets[b].count = 0;
+    }
+    for (unsigned i=0; i < g->cfg->samples; ++i)
+    {
+        g->bucket[i] = UINT32_MAX;
+    }
+}
+
+/*
+ *  Moves each seed whose bucket has changed since the last call
+ */
+static void grid_update(Grid* g)
+{
+    for (unsigned i=0; i < g->cfg->samples; ++i)
+    {
+        uint32_t b = fh_bucket(g->pts[i][1], g->gy) * g->gx +
+                     fh_bucket(g->pts[i][0], g->gx);
+        if (b == g->bucket[i])
+        {
+            continue;
+        }
+
+        if (g->bucket[i] != UINT32_MAX)
+        {
+            /*  Swap the last seed of the old bucket into this one's slot  */
+            GridBucket* old = &g->buckets[g->bucket[i]];
+            uint32_t last = old->seeds[--old->count];
+            old->seeds[g->slot[i]] = last;
+            g->slot[last] = g->slot[i];
+        }
+
+        GridBucket* k = &g->buckets[b];
+        if (k->count == k->cap)
+        {
+            k->cap = k->cap ? 2 * k->cap : 4;
+            k->seeds = (uint32_t*)realloc(k->seeds, k->cap * sizeof(uint32_t));
+        }
+        g->slot[i] = k->count;
+        k->seeds[k->count++] = i;
+        g->bucket[i] = b;
+    }
+}
+
+/*
+ *  Labels one tile and adds its pixels to the given sums
+ */
+static void grid_tile(const Grid* g, unsigned tx, unsigned ty,
+                      unsigned t, double (*sums)[4])
+{
+    const Config* c = g->cfg;
+    const double bw = (double)c->width / g->gx;
+    const double bh = (double)c->height / g->gy;
+    const float x0 = tx * bw, x1 = (tx + 1) * bw;
+    const float y0 = ty * bh, y1 = (ty + 1) * bh;
+
+    float* cx = &g->cx[t * c->samples];
+    float* cy = &g->cy[t * c->samples];
+    float* cmin = &g->cmin[t * c->samples];
+    uint32_t* ci = &g->ci[t * c->samples];
+
+    /*  Search rings of buckets around the tile until no seed beyond them  *
+     *  could be nearer than the bound (the nearest any seed is to the    *
+     *  tile's farthest corner), which every pixel in the tile meets      */
+    unsigned n = 0;
+    float bound = INFINITY;
+    const unsigned rings = (g->gx > g->gy) ? g->gx : g->gy;
+    for (unsigned r=0; r < rings; ++r)
+    {
+        const float gap = (r ? r - 1 : 0) * fmin(bw, bh);
+        if (r && gap * gap > bound)
+        {
+            break;
+        }
+
+        for (int by=(int)ty - (int)r; by <= (int)(ty + r); ++by)
+        {
+            if (by < 0 || by >= (int)g->gy)
+            {
+                continue;
+            }
+            const bool edge = (by == (int)ty - (int)r || by == (int)(ty + r));
+            const int step = (edge || r == 0) ? 1 : 2 * r;
+            for (int bx=(int)tx - (int)r; bx <= (int)(tx + r); bx += step)
+            {
+                if (bx < 0 || bx >= (int)g->gx)
+                {
+                    continue;
+                }
+                const GridBucket* k = &g->buckets[by * g->gx + bx];
+                for (uint32_t j=0; j < k->count; ++j)
+                {
+                    const uint32_t i = k->seeds[j];
+                    const float px = g->pts[i][0] * c->width;
+                    const float py = g->pts[i][1] * c->height;
+
+                    const float nx = fmaxf(fmaxf(x0 - px, px - x1), 0);
+                    const float ny = fmaxf(fmaxf(y0 - py, py - y1), 0);
+                    const float fx = fmaxf(px - x0, x1 - px);
+                    const float fy = fmaxf(py - y0, y1 - py);
+                    bound = fminf(bound, fx * fx + fy * fy);
+
+                    cx[n] = px;
+                    cy[n] = py;
+                    cmin[n] = nx * nx + ny * ny;
+                    ci[n++] = i;
+                }
+            }
+        }
+    }
+
+    /*  Drop candidates that can't be nearest to any pixel in the tile  */
+    unsigned m = 0;
+    bool active = !g->frozen;
+    for (unsigned j=0; j < n; ++j)
+    {
+        if (cmin[j] <= bound)
+        {
+            cx[m] = cx[j];
+            cy[m] = cy[j];
+            ci[m++] = ci[j];
+            active = active || !g->frozen[ci[j]];
+        }
+    }
+
+    /*  Frozen seeds aren't moved, so tiles of only frozen cells can go  */
+    if (!active)
+    {
+        return;
+    }
+
+    /*  Pixels whose centers are in the tile  */
+    const unsigned px0 = (unsigned)ceil(x0 - 0.5);
+    const unsigned px1 = (unsigned)fmin(ceil(x1 - 0.5), c->width);
+    const unsigned py0 = (unsigned)ceil(y0 - 0.5);
+    const unsigned py1 = (unsigned)fmin(ceil(y1 - 0.5), c->height);
+    if (px0 >= px1)
+    {
+        return;
+    }
+
+    float* dy2 = &g->dy2[t * c->samples];
+    uint32_t* labels = &g->labels[t * c->width];
+    for (unsigned y=py0; y < py1; ++y)
+    {
+        const float fy = y + 0.5f;
+        for (unsigned j=0; j < m; ++j)
+        {
+            const float dy = cy[j] - fy;
+            dy2[j] = dy * dy;
+        }
+        g->row(cx, dy2, ci, m, px0, px1, labels);
+
+        /*  Accumulate runs of pixels with the same label, touching each  *
+         *  run's sums once                                               */
+        const stbi_uc* img = &c->img[y * c->width];
+        unsigned x = px0;
+        while (x < px1)
+        {
+            const uint32_t label = labels[x - px0];
+            double w = 0, xw = 0;
+            unsigned count = 0;
+            for (; x < px1 && labels[x - px0] == label; ++x, ++count)
+            {
+                const double wx = g->weight[img[x]];
+                w += wx;
+                xw += wx * (x + 0.5);
+            }
+
+            double* s = sums[label];
+            s[0] += xw / c->width;
+            s[1] += w * fy / c->height;
+            s[2] += count;
+            s[3] += w;
+        }
+    }
+}
+
+static void grid_tiles(void* data, unsigned t)
+{
+    const Grid* g = (const Grid*)data;
+    const Config* c = g->cfg;
+    double (*sums)[4] = &g->sums[t * c->samples];
+    memset(sums, 0, c->samples * sizeof(*sums));
+
+    /*  Interleave tiles across threads, which balances dense and sparse  *
+     *  regions of the image                                              */
+    for (unsigned k=t; k < g->gx * g->gy; k += c->threads)
+    {
+        grid_tile(g, k % g->gx, k / g->gx, t, sums);
+    }
+}
+
+/*
+ *  Labels every pixel with its nearest seed, summing each cell into the
+ *  per-thread sums
+ */
+void grid_label(Grid* g, const float (*pts)[3])
+{
+    g->pts = pts;
+    grid_update(g);
+    parallel_for(g->cfg->threads, grid_tiles, g);
+}
+
+/*
+ *  Returns the seed nearest to a point (in pixels), searching rings of
+ *  buckets outward from the point's own, with ties to the lower index
+ */
+uint32_t grid_nearest(const Grid* g, float px, float py)
+{
+    const Config* c = g->cfg;
+    const float size = fmin((double)c->width / g->gx,
+                            (double)c->height / g->gy);
+    const int tx = fh_bucket(px / c->width, g->gx);
+    const int ty = fh_bucket(py / c->height, g->gy);
+
+    float best = INFINITY;
+    uint32_t label = 0;
+    const unsigned rings = (g->gx > g->gy) ? g->gx : g->gy;
+    for (int r=0; r < (int)rings; ++r)
+    {
+        const float gap = (r ? r - 1 : 0) * size;
+        if (r && gap * gap > best)
+        {
+            break;
+        }
+
+        for (int by=ty - r; by <= ty + r; ++by)
+        {
+            if (by < 0 || by >= (int)g->gy)
+            {
+                continue;
+            }
+            const bool edge = (by == ty - r || by == ty + r);
+            const int step = (edge || r == 0) ? 1 : 2 * r;
+            for (int bx=tx - r; bx <= tx + r; bx += step)
+            {
+                if (bx < 0 || bx >= (int)g->gx)
+                {
+                    continue;
+                }
+                const GridBucket* k = &g->buckets[by * g->gx + bx];
+                for (uint32_t j=0; j < k->count; ++j)
+                {
+                    const uint32_t i = k->seeds[j];
+                    const float dx = g->pts[i][0] * c->width - px;
+                    const float dy = g->pts[i][1] * c->height - py;
+                    const float d = dx * dx + dy * dy;
+                    if (d < best || (d == best && i < label))
+                    {
+                        best = d;
+                        label = i;
+                    }
+                }
+            }
+        }
+    }
+    return label;
+}
+
+/******************************************************************************/
+
+/*
+ *  The minibatch solver (online k-means) replaces each full pass with a
+ *  batch of pixels drawn in proportion to their stipple weight, from an
+ *  alias table in O(1) each.  Each sample pulls its nearest seed towards
+ *  it by 1 / (samples that seed has seen), so each seed tracks the running
+ *  centroid of the density it has been shown, and its weight tracks the
+ *  mean density of its cell (the reciprocal of the running mean of 1 / w,
+ *  since samples are already weighted by w).
+ */
+typedef struct MbAlias_
+{
+    float prob;             /*  Pixel i is drawn with probability prob, *
+                             *  else pixel alias is                     */
+    uint32_t alias;
+} MbAlias;
+
+typedef struct Mb_
+{
+    Config* cfg;            /*  Non-const, for its random generator     */
+    Grid* grid;             /*  Seed lookups                            */
+    unsigned batch;
+
+    MbAlias* table;         /*  Alias table, one entry per pixel, kept  *
+                             *  together so a draw is one cache miss    */
+
+    uint32_t* pixel;        /*  This batch's pixels                     */
+    uint32_t* nearest;      /*  And their nearest seeds                 */
+    double* seen;           /*  Samples seen by each seed (0 if unset)  */
+    double* inv_w;          /*  Running mean of 1 / w for each seed     */
+} Mb;
+
+Mb* mb_new(Config* c, Grid* grid)
+{
+    Mb* m = (Mb*)calloc(1, sizeof(Mb));
+    m->cfg = c;
+    m->grid = grid;
+    m->batch = c->batch;
+    m->pixel = (uint32_t*)malloc(c->batch * sizeof(uint32_t));
+    m->nearest = (uint32_t*)malloc(c->batch * sizeof(uint32_t));
+    m->seen = (double*)calloc(c->samples, sizeof(double));
+    m->inv_w = (double*)malloc(c->samples * sizeof(double));
+
+    /*  Vose's alias method:  scale each weight so the mean is 1, then   *
+     *  pair each light pixel with a heavy one that tops it up           */
+    const size_t n = (size_t)c->width * c->height;
+    m->table = (MbAlias*)malloc(n * sizeof(MbAlias));
+    double* p = (double*)malloc(n * sizeof(double));
+    uint32_t* small = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* large = (uint32_t*)malloc(n * sizeof(uint32_t));
+
+    double total = 0;
+    for (size_t i=0; i < n; ++i)
+    {
+        p[i] = 0.01 + 0.99 * (1.0 - c->img[i] / 255.0);
+        total += p[i];
+    }
+    size_t ns = 0, nl = 0;
+    for (size_t i=0; i < n; ++i)
+    {
+        p[i] *= n / total;
+        if (p[i] < 1)   small[ns++] = i;
+        else            large[nl++] = i;
+    }
+    while (ns && nl)
+    {
+        uint32_t s = small[--ns];
+        uint32_t l = large[nl - 1];
+        m->table[s] = (MbAlias){.prob = p[s], .alias = l};
+        p[l] -= 1 - p[s];
+        if (p[l] < 1)
+        {
+            nl--;
+            small[ns++] = l;
+        }
+    }
+    /*  Whatever is left is 1 up to rounding  */
+    while (nl)  { m->table[large[--nl]].prob = 1; }
+    while (ns)  { m->table[small[--ns]].prob = 1; }
+
+    free(p);
+    free(small);
+    free(large);
+    return m;
+}
+
+/*
+ *  Frees the solver, but not its grid
+ */
+void mb_free(Mb* m)
+{
+    free(m->table);
+    free(m->pixel);
+    free(m->nearest);
+    free(m->seen);
+    free(m->inv_w);
+    free(m);
+}
+
+static void mb_assign(void* data, unsigned t)
+{
+    const Mb* m = (const Mb*)data;
+    const Config* c = m->cfg;
+    unsigned b0 = m->batch * t / c->threads;
+    unsigned b1 = m->batch * (t + 1) / c->threads;
+    for (unsigned b=b0; b < b1; ++b)
+    {
+        m->nearest[b] = grid_nearest(m->grid,
+                m->pixel[b] % c->width + 0.5f,
+                m->pixel[b] / c->width + 0.5f);
+    }
+}
+
+/*
+ *  Runs one minibatch:  draws it, assigns it to the seeds as they stand
+ *  (in parallel), then applies the updates in order
+ */
+void mb_step(Mb* m, float (*pts)[3])
+{
+    Config* c = m->cfg;
+    const size_t n = (size_t)c->width * c->height;
+
+    /*  Step sizes aren't checkpointed, so a seed starts (or resumes) as  *
+     *  if it had seen its share of every batch so far                    */
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        if (m->seen[i] == 0)
+        {
+            m->seen[i] = 1 + (double)c->step * m->batch / c->samples;
+            const size_t p = fh_bucket(pts[i][1], c->height) * c->width +
+                             fh_bucket(pts[i][0], c->width);
+            m->inv_w[i] = 1 / ((pts[i][2] > 0) ? pts[i][2]
+                               : 0.01 + 0.99 * (1.0 - c->img[p] / 255.0));
+        }
+    }
+
+    m->grid->pts = (const float (*)[3])pts;
+    grid_update(m->grid);
+
+    for (unsigned b=0; b < m->batch; ++b)
+    {
+        uint32_t i = (uint32_t)(((uint64_t)config_rand(c) * n) >> 32);
+        bool keep = config_rand(c) < m->table[i].prob * 4294967296.0;
+        m->pixel[b] = keep ? i : m->table[i].alias;
+    }
+    parallel_for(c->threads, mb_assign, m);
+
+    for (unsigned b=0; b < m->batch; ++b)
+    {
+        const uint32_t i = m->nearest[b];
+        const uint32_t p = m->pixel[b];
+        const double eta = 1 / ++m->seen[i];
+        const double w = 0.01 + 0.99 * (1.0 - c->img[p] / 255.0);
+
+        pts[i][0] += eta * ((p % c->width + 0.5) / c->width - pts[i][0]);
+        pts[i][1] += eta * ((p / c->width + 0.5) / c->height - pts[i][1]);
+        m->inv_w[i] += eta * (1 / w - m->inv_w[i]);
+        pts[i][2] = 1 / m->inv_w[i];
+    }
+}
+
+/******************************************************************************/
+
+/*
+ *  Active-set mode:  a seed that has moved less than cfg->freeze pixels for
+ *  FREEZE_ITERATIONS iterations in a row is frozen, and its cell is no
+ *  longer summed (so it stays where it is).  Moving seeds wake every seed
+ *  within FREEZE_REACH grid buckets of them, since their neighbors' cells
+ *  change as they move, and every FREEZE_REVALIDATE iterations all seeds
+ *  are summed again so that frozen seeds that have drifted wake up.
+ */
+#define FREEZE_ITERATIONS 4
+#define FREEZE_REVALIDATE 16
+#define FREEZE_REACH 2
+
+typedef struct Freeze_
+{
+    const Config* cfg;
+    Grid* grid;             /*  Neighbor lookups (buckets only)         */
+    float (*prev)[2];       /*  Seed positions after the last update    */
+    uint8_t* still;         /*  Consecutive iterations below threshold  */
+    uint8_t* frozen;        /*  Cells to skip in the next iteration     */
+    unsigned count;         /*  Frozen seeds in the next iteration      */
+
+    double skipped;         /*  Total fraction of cells skipped         */
+    unsigned updates;
+} Freeze;
+
+Freeze* freeze_new(const Config* c, Grid* grid)
+{
+    Freeze* z = (Freeze*)calloc(1, sizeof(Freeze));
+    z->cfg = c;
+    z->grid = grid;
+    z->prev = (float (*)[2])malloc(c->samples * sizeof(*z->prev));
+    z->still = (uint8_t*)calloc(c->samples, 1);
+    z->frozen = (uint8_t*)calloc(c->samples, 1);
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        z->prev[i][0] = NAN;
+    }
+    return z;
+}
+
+/*
+ *  Records the seeds' new positions and picks the cells to skip in the
+ *  next iteration (returning how many)
+ */
+unsigned freeze_update(Freeze* z, const float (*pts)[3])
+{
+    const Config* c = z->cfg;
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        const float dx = (pts[i][0] - z->prev[i][0]) * c->width;
+        const float dy = (pts[i][1] - z->prev[i][1]) * c->height;
+        const bool still = dx * dx + dy * dy < c->freeze * c->freeze;
+        z->still[i] = still ? (z->still[i] < UINT8_MAX ? z->still[i] + 1
+                                                       : UINT8_MAX)
+                            : 0;
+        z->prev[i][0] = pts[i][0];
+        z->prev[i][1] = pts[i][1];
+        z->frozen[i] = (z->still[i] >= FREEZE_ITERATIONS) &&
+                       ((c->step + 1) % FREEZE_REVALIDATE != 0);
+    }
+
+    Grid* g = z->grid;
+    g->pts = pts;
+    grid_update(g);
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        if (z->still[i] >= FREEZE_ITERATIONS)
+        {
+            continue;
+        }
+        const int tx = g->bucket[i] % g->gx;
+        const int ty = g->bucket[i] / g->gx;
+        for (int by=ty - FREEZE_REACH; by <= ty + FREEZE_REACH; ++by)
+        {
+            for (int bx=tx - FREEZE_REACH; bx <= tx + FREEZE_REACH; ++bx)
+            {
+                if (bx < 0 || by < 0 || bx >= (int)g->gx || by >= (int)g->gy)
+                {
+                    continue;
+                }
+                const GridBucket* k = &g->buckets[by * g->gx + bx];
+                for (uint32_t j=0; j < k->count; ++j)
+                {
+                    z->frozen[k->seeds[j]] = 0;
+                }
+            }
+        }
+    }
+
+    z->count = 0;
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        z->count += z->frozen[i];
+    }
+    z->skipped += (double)z->count / c->samples;
+    z->updates++;
+    return z->count;
+}
+
+/*
+ *  Renumbers the per-seed state after the seeds have been reordered
+ */
+void freeze_permute(Freeze* z, const uint32_t* perm)
+{
+    seeds_permute(z->cfg, perm, z->prev, sizeof(*z->prev));
+    seeds_permute(z->cfg, perm, z->still, sizeof(*z->still));
+    seeds_permute(z->cfg, perm, z->frozen, sizeof(*z->frozen));
+    grid_reset(z->grid);
+}
+
+void freeze_report(const Freeze* z)
+{
+    fprintf(stderr, "Frozen cells: %.1f%% skipped on average\n",
+            100 * z->skipped / (z->updates ? z->updates : 1));
+}
+
+/*
+ *  Frees the active set, but not its grid
+ */
+void freeze_free(Freeze* z)
+{
+    free(z->prev);
+    free(z->still);
+    free(z->frozen);
+    free(z);
+}
+
+/******************************************************************************/
+
+/*
+ *  Incremental relabelling:  the label texture is split into DIRTY_TILE
+ *  square tiles, and only tiles that a moving seed (one that has moved more
+ *  than cfg->relabel pixels since it was last drawn) could be nearest to,
+ *  at either its old or its new position, are redrawn.  A tile's reach is
+ *  the squared distance from its farthest corner to the seed nearest its
+ *  center, which bounds how far away its nearest seed can be.  Dirty tiles
+ *  are merged into one scissor rectangle per run of tile rows with the same
+ *  span, and everything is redrawn once more than half is dirty.
+ */
+#define DIRTY_TILE 32
+
+typedef struct Dirty_
+{
+    const Config* cfg;
+    Grid* grid;             /*  Nearest-seed lookups                    */
+    float (*prev)[2];       /*  Seed positions when last drawn          */
+    unsigned tx, ty;        /*  Tiles across and down                   */
+    float* reach;           /*  Per-tile reach at the last update       */
+    float* fresh;           /*  And at this update                      */
+    uint8_t* dirty;
+
+    GLint (*rects)[4];      /*  Scissor rectangles (x, y, w, h)         */
+    unsigned rect_count;
+    bool partial;           /*  Set if only the rectangles are redrawn  */
+
+    double touched;         /*  Total fraction of pixels relabelled     */
+    unsigned updates;
+} Dirty;
+
+Dirty* dirty_new(const Config* c, Grid* grid)
+{
+    Dirty* d = (Dirty*)calloc(1, sizeof(Dirty));
+    d->cfg = c;
+    d->grid = grid;
+    d->prev = (float (*)[2])malloc(c->samples * sizeof(*d->prev));
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        d->prev[i][0] = NAN;
+    }
+
+    d->tx = (c->width + DIRTY_TILE - 1) / DIRTY_TILE;
+    d->ty = (c->height + DIRTY_TILE - 1) / DIRTY_TILE;
+    d->reach = (float*)calloc(d->tx * d->ty, sizeof(float));
+    d->fresh = (float*)malloc(d->tx * d->ty * sizeof(float));
+    d->dirty = (uint8_t*)malloc(d->tx * d->ty);
+    d->rects = (GLint (*)[4])malloc(d->ty * sizeof(*d->rects));
+    return d;
+}
+
+/*
+ *  Marks the tiles that a seed at (x, y) (in pixels) could be nearest to
+ */
+static void dirty_mark(Dirty* d, float x, float y, float reach)
+{
+    const int r = (int)ceilf(sqrtf(reach) / DIRTY_TILE);
+    const int cx = (int)(x / DIRTY_TILE), cy = (int)(y / DIRTY_TILE);
+    for (int ty=cy - r; ty <= cy + r; ++ty)
+    {
+        for (int tx=cx - r; tx <= cx + r; ++tx)
+        {
+            if (tx < 0 || ty < 0 || tx >= (int)d->tx || ty >= (int)d->ty)
+            {
+                continue;
+            }
+            const float dx = fmaxf(fmaxf(tx * DIRTY_TILE - x,
+                                         x - (tx + 1) * DIRTY_TILE), 0);
+            const float dy = fmaxf(fmaxf(ty * DIRTY_TILE - y,
+                                         y - (ty + 1) * DIRTY_TILE), 0);
+            if (dx * dx + dy * dy <= d->reach[ty * d->tx + tx])
+            {
+                d->dirty[ty * d->tx + tx] = 1;
+            }
+        }
+    }
+}
+
+/*
+ *  Picks the regions to redraw in the next labelling, given the seeds
+ *  that it will draw
+ */
+void dirty_update(Dirty* d, const float (*pts)[3])
+{
+    const Config* c = d->cfg;
+    Grid* g = d->grid;
+    g->pts = pts;
+    grid_update(g);
+
+    /*  A tile's reach is the larger of its old and new reach, so that  *
+     *  it covers both the seeds that drew it and those that will        */
+    float reach_max = 0;
+    for (unsigned ty=0; ty < d->ty; ++ty)
+    {
+        for (unsigned tx=0; tx < d->tx; ++tx)
+        {
+            const float x0 = tx * DIRTY_TILE;
+            const float y0 = ty * DIRTY_TILE;
+            const float x1 = fminf(x0 + DIRTY_TILE, c->width);
+            const float y1 = fminf(y0 + DIRTY_TILE, c->height);
+            const uint32_t s = grid_nearest(g, (x0 + x1) / 2, (y0 + y1) / 2);
+            const float px = pts[s][0] * c->width, py = pts[s][1] * c->height;
+            const float fx = fmaxf(px - x0, x1 - px);
+            const float fy = fmaxf(py - y0, y1 - py);
+
+            const unsigned t = ty * d->tx + tx;
+            d->fresh[t] = fx * fx + fy * fy;
+            d->reach[t] = fmaxf(d->reach[t], d->fresh[t]);
+            reach_max = fmaxf(reach_max, d->reach[t]);
+        }
+    }
+
+    memset(d->dirty, 0, d->tx * d->ty);
+    bool all = false;
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        const float x = pts[i][0] * c->width, y = pts[i][1] * c->height;
+        const float px = d->prev[i][0] * c->width;
+        const float py = d->prev[i][1] * c->height;
+        const float dx = x - px, dy = y - py;
+        if (dx * dx + dy * dy < c->relabel * c->relabel)
+        {
+            continue;
+        }
+
+        if (isnan(px))
+        {
+            all = true;
+        }
+        else
+        {
+            dirty_mark(d, px, py, reach_max);
+        }
+        dirty_mark(d, x, y, reach_max);
+        d->prev[i][0] = pts[i][0];
+        d->prev[i][1] = pts[i][1];
+    }
+
+    memcpy(d->reach, d->fresh, d->tx * d->ty * sizeof(float));
+
+    /*  Merge each tile row's dirty span into rectangles  */
+    d->rect_count = 0;
+    size_t area = 0;
+    for (unsigned ty=0; ty < d->ty && !all; ++ty)
+    {
+        int first = -1, last = -1;
+        for (unsigned tx=0; tx < d->tx; ++tx)
+        {
+            if (d->dirty[ty * d->tx + tx])
+            {
+                first = (first < 0) ? (int)tx : first;
+                last = tx;
+            }
+        }
+        if (first < 0)
+        {
+            continue;
+        }
+
+        const GLint x = first * DIRTY_TILE, y = ty * DIRTY_TILE;
+        const GLint w = (GLint)fminf((last + 1) * DIRTY_TILE, c->width) - x;
+        const GLint h = (GLint)fminf(y + DIRTY_TILE, c->height) - y;
+        GLint* prev = d->rect_count ? d->rects[d->rect_count - 1] : NULL;
+        if (prev && prev[0] == x && prev[2] == w && prev[1] + prev[3] == y)
+        {
+            prev[3] += h;
+        }
+        else
+        {
+            GLint* r = d->rects[d->rect_count++];
+            r[0] = x;
+            r[1] = y;
+            r[2] = w;
+            r[3] = h;
+        }
+        area += (size_t)w * h;
+    }
+
+    const size_t pixels = (size_t)c->width * c->height;
+    d->partial = !all && 2 * area <= pixels;
+    d->touched += d->partial ? (double)area / pixels : 1;
+    d->updates++;
+}
+
+void dirty_report(const Dirty* d)
+{
+    fprintf(stderr, "Incremental relabelling: %.1f%% of pixels redrawn"
+                    " on average\n",
+            100 * d->touched / (d->updates ? d->updates : 1));
+}
+
+/*
+ *  Frees the tracker, but not its grid
+ */
+void dirty_free(Dirty* d)
+{
+    free(d->prev);
+    free(d->reach);
+    free(d->fresh);
+    free(d->dirty);
+    free(d->rects);
+    free(d);
+}
+
+/******************************************************************************/
+
+/*
+ *  Reseeding:  a cell that covers no pixels strands its seed (and wastes
+ *  its stipple), so after each update the seeds of empty cells are moved
+ *  into the heaviest cells, which are the most under-served since every
+ *  cell should end up carrying the same mass.  Each heaviest cell is split
+ *  in two:  its seed and the reseeded one are placed on either side of its
+ *  centroid, half its radius away in a random direction.  Seeds that have
+ *  left the image's coordinates (NaN) count as empty, and frozen cells
+ *  (marked with a negative mass) are neither reseeded nor split.
+ */
+typedef struct ReseedRank_
+{
+    float mass;
+    uint32_t index;
+} ReseedRank;
+
+typedef struct Reseed_
+{
+    Config* cfg;
+    float (*cells)[2];      /*  Mass (0 if empty) and pixels of each cell */
+    uint32_t* empty;        /*  Cells to reseed in this update          */
+    ReseedRank* rank;       /*  Non-empty cells, heaviest first         */
+    unsigned count;         /*  Seeds reseeded by the last update       */
+
+    unsigned most;          /*  Most seeds reseeded in one update       */
+    unsigned long total;
+    unsigned updates;
+} Reseed;
+
+Reseed* reseed_new(Config* c)
+{
+    Reseed* e = (Reseed*)calloc(1, sizeof(Reseed));
+    e->cfg = c;
+    e->cells = (float (*)[2])calloc(c->samples, sizeof(*e->cells));
+    e->empty = (uint32_t*)malloc(c->samples * sizeof(*e->empty));
+    e->rank = (ReseedRank*)malloc(c->samples * sizeof(*e->rank));
+    return e;
+}
+
+static int reseed_cmp(const void* a, const void* b)
+{
+    const ReseedRank* ra = (const ReseedRank*)a;
+    const ReseedRank* rb = (const ReseedRank*)b;
+    if (ra->mass != rb->mass)
+    {
+        return ra->mass > rb->mass ? -1 : 1;
+    }
+    return ra->index < rb->index ? -1 : (ra->index > rb->index);
+}
+
+static float reseed_clamp(float x)
+{
+    return fminf(fmaxf(x, 0.0f), 1.0f);
+}
+
+/*
+ *  Moves the seeds of empty cells (given e->cells) into the heaviest cells,
+ *  returning how many were moved.  Subsampled iterations can miss small
+ *  cells entirely, so nothing is reseeded during them.
+ */
+unsigned reseed_update(Reseed* e, float (*pts)[3])
+{
+    Config* c = e->cfg;
+
+    unsigned empty = 0;
+    unsigned ranked = 0;
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        const float mass = e->cells[i][0];
+        if (mass < 0)
+        {
+            continue;
+        }
+        else if (!(mass > 0) || !isfinite(pts[i][0]) || !isfinite(pts[i][1]))
+        {
+            e->empty[empty++] = i;
+        }
+        else
+        {
+            e->rank[ranked++] = (ReseedRank){ .mass = mass, .index = i };
+        }
+    }
+
+    e->count = (c->step < c->subsample) ? 0
+             : (empty < ranked ? empty : ranked);
+    if (e->count)
+    {
+        qsort(e->rank, ranked, sizeof(*e->rank), reseed_cmp);
+    }
+
+    for (unsigned j=0; j < e->count; ++j)
+    {
+        const uint32_t i = e->empty[j];
+        const uint32_t h = e->rank[j].index;
+
+        /*  Half the radius of a disk with the heavy cell's area  */
+        const float r = 0.5f * sqrtf(e->cells[h][1] / (float)M_PI);
+        const float a = config_rand(c) * (float)(2 * M_PI / 4294967296.0);
+        const float dx = r * cosf(a) / c->width;
+        const float dy = r * sinf(a) / c->height;
+
+        pts[i][0] = reseed_clamp(pts[h][0] + dx);
+        pts[i][1] = reseed_clamp(pts[h][1] + dy);
+        pts[i][2] = pts[h][2];
+        pts[h][0] = reseed_clamp(pts[h][0] - dx);
+        pts[h][1] = reseed_clamp(pts[h][1] - dy);
+    }
+
+    e->most = e->count > e->most ? e->count : e->most;
+    e->total += e->count;
+    e->updates++;
+    return e->count;
+}
+
+void reseed_report(const Reseed* e)
+{
+    fprintf(stderr, "Reseeded %lu empty cells (%.2f per iteration,"
+                    " at most %u in one)\n",
+            e->total, (double)e->total / (e->updates ? e->updates : 1),
+            e->most);
+}
+
+void reseed_free(Reseed* e)
+{
+    free(e->cells);
+    free(e->empty);
+    free(e->rank);
+    free(e);
+}
+
+/******************************************************************************/
+
+/*
+ *  The Delaunay backend finds each Voronoi cell exactly, as a polygon:  it
+ *  triangulates the seeds, walks each seed's fan of triangles to collect
+ *  the circumcenters that bound its cell, clips the cell to the image, and
+ *  integrates the density over it.  The density is constant over each
+ *  pixel, so the integrals become line integrals along the cell's edges
+ *  (by Green's theorem) of per-row prefix sums, which are exact once edges
+ *  are split where they cross pixel boundaries.
+ *
+ *  The triangulation lives in pixel coordinates, inside a super triangle
+ *  far enough away that its vertices are never nearer to the image than
+ *  the seeds are, so the cells of hull seeds stay bounded.  It is built
+ *  once (Bowyer-Watson), then kept as the seeds move:  each iteration moves
+ *  its vertices and restores the Delaunay property with edge flips, and
+ *  only rebuilds if a move turned a triangle over.  Vertices are snapped
+ *  to a fixed-point grid, so that the orientation and incircle predicates
+ *  can be evaluated exactly in integer arithmetic.
+ */
+typedef struct DtTri_
+{
+    uint32_t v[3];      /*  Vertices, counter-clockwise (v[0] is      *
+                         *  UINT32_MAX if the slot is free)           */
+    int32_t n[3];       /*  Neighbor opposite each vertex, or -1      */
+} DtTri;
+
+typedef struct DtEdge_
+{
+    uint32_t a, b;      /*  Cavity boundary edge, counter-clockwise  */
+    int32_t out;        /*  Triangle on the far side, or -1          */
+} DtEdge;
+
+typedef struct Dt_
+{
+    const Config* cfg;
+    double (*p)[2];     /*  Seeds (in pixels), then the super triangle  */
+    int64_t (*q)[2];    /*  The same, in fixed-point grid steps         */
+    double scale;       /*  Grid steps per pixel                        */
+    int32_t* corner;    /*  A triangle using each vertex, or -1         */
+    uint32_t* order;    /*  Insertion order (spatially coherent)        */
+    uint32_t* bucket;   /*  Bucket offsets for sorting into that order  */
+
+    DtTri* tri;
+    uint32_t* mark;     /*  Visit stamps for the cavity search          */
+    uint32_t tri_count, tri_cap;
+
+    int32_t* stack;     /*  Scratch space for the cavity search         */
+    int32_t* cavity;
+    int32_t* unused;    /*  Free triangle slots                         */
+    uint32_t unused_count;
+    DtEdge* edges;
+    int32_t* fan;       /*  New triangle starting at each vertex        */
+    uint8_t* queued;    /*  Triangles waiting on the flip stack         */
+    bool built;         /*  Whether tri holds the current seed set      */
+
+    double* prefix_w;   /*  Per-row prefix sums of the density, and of  */
+    double* prefix_xw;  /*  x times the density (h rows of w + 1)       */
+    double (*poly)[2];  /*  Per-thread polygon buffers (2 per thread)   */
+    uint32_t poly_cap;
+
+    double (*sums)[4];  /*  Output: per-cell integrals, in the layout   *
+                         *  of the summation texture                    */
+    const uint8_t* frozen;  /*  Cells to skip, or NULL                  */
+
+    unsigned long updates;
+    unsigned long rebuilds;
+    unsigned long flips;
+    unsigned long jitters;  /*  Duplicate seeds nudged apart            */
+} Dt;
+
+Dt* dt_new(const Config* c, double (*sums)[4])
+{
+    Dt* d = (Dt*)calloc(1, sizeof(Dt));
+    const unsigned n = c->samples + 3;
+
+    d->cfg = c;
+    d->sums = sums;
+    d->p = (double (*)[2])malloc(n * sizeof(*d->p));
+    d->q = (int64_t (*)[2])malloc(n * sizeof(*d->q));
+    d->corner = (int32_t*)malloc(n * sizeof(int32_t));
+    d->order = (uint32_t*)malloc(c->samples * sizeof(uint32_t));
+    d->fan = (int32_t*)malloc(n * sizeof(int32_t));
+
+    /*  A triangulation of n vertices has at most 2n - 5 triangles, and  *
+     *  slots freed from a cavity are reused before new ones are made    */
+    d->tri_cap = 2 * n;
+    d->tri = (DtTri*)malloc(d->tri_cap * sizeof(DtTri));
+    d->mark = (uint32_t*)malloc(d->tri_cap * sizeof(uint32_t));
+    d->stack = (int32_t*)malloc(d->tri_cap * sizeof(int32_t));
+    d->cavity = (int32_t*)malloc(d->tri_cap * sizeof(int32_t));
+    d->unused = (int32_t*)malloc(d->tri_cap * sizeof(int32_t));
+    d->edges = (DtEdge*)malloc((d->tri_cap + 2) * sizeof(DtEdge));
+    d->queued = (uint8_t*)calloc(d->tri_cap, 1);
+
+    /*  The grid is the finest power of two for which coordinates (out to  *
+     *  the super triangle, at about 31 image sizes) stay below 2^29, so   *
+     *  that the incircle determinant fits in 128 bits                     */
+    d->scale = 1;
+    while (d->scale * 62 * fmax(c->width, c->height) <= (1 << 29))
+    {
+        d->scale *= 2;
+    }
+
+    /*  Spatial sort buckets (see dt_order)  */
+    unsigned g = (unsigned)ceil(sqrt(c->samples / 4.0));
+    d->bucket = (uint32_t*)malloc((g * g + 1) * sizeof(uint32_t));
+
+    const size_t stride = c->width + 1;
+    d->prefix_w = (double*)malloc(c->height * stride * sizeof(double));
+    d->prefix_xw = (double*)malloc(c->height * stride * sizeof(double));
+    for (unsigned y=0; y < c->height; ++y)
+    {
+        double* pw = &d->prefix_w[y * stride];
+        double* pxw = &d->prefix_xw[y * stride];
+        pw[0] = pxw[0] = 0;
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            double w = 0.01 + 0.99 * (1.0 - c->img[y * c->width + x] / 255.0);
+            pw[x + 1] = pw[x] + w;
+            pxw[x + 1] = pxw[x] + w * (x + 0.5);
+        }
+    }
+
+    /*  A cell has one vertex per triangle around its seed, plus up to    *
+     *  four more from clipping                                           */
+    d->poly_cap = n + 8;
+    d->poly = (double (*)[2])malloc(
+            2 * c->threads * d->poly_cap * sizeof(*d->poly));
+    return d;
+}
+
+/*
+ *  Places vertex i at (x, y) pixels, snapped to the fixed-point grid
+ */
+static void dt_place(Dt* d, uint32_t i, double x, double y)
+{
+    d->q[i][0] = llround(x * d->scale);
+    d->q[i][1] = llround(y * d->scale);
+    d->p[i][0] = d->q[i][0] / d->scale;
+    d->p[i][1] = d->q[i][1] / d->scale;
+}
+
+/*
+ *  Returns twice the signed area of triangle abc, in squared grid steps
+ *  (positive if it's counter-clockwise).  Coordinates are below 2^29, so
+ *  this is exact.
+ */
+static int64_t dt_orient(const Dt* d, uint32_t a, uint32_t b, uint32_t c)
+{
+    const int64_t* A = d->q[a];
+    const int64_t* B = d->q[b];
+    const int64_t* C = d->q[c];
+    return (B[0] - A[0]) * (C[1] - A[1]) - (B[1] - A[1]) * (C[0] - A[0]);
+}
+
+/*
+ *  Returns true if p is strictly inside the circumcircle of the
+ *  counter-clockwise triangle abc.  Each term is below 2^122, so the
+ *  determinant is exact in 128 bits.
+ */
+static bool dt_incircle(const Dt* d, uint32_t a, uint32_t b, uint32_t c,
+                        uint32_t p)
+{
+    const int64_t* P = d->q[p];
+    const int64_t adx = d->q[a][0] - P[0], ady = d->q[a][1] - P[1];
+    const int64_t bdx = d->q[b][0] - P[0], bdy = d->q[b][1] - P[1];
+    const int64_t cdx = d->q[c][0] - P[0], cdy = d->q[c][1] - P[1];
+    const __int128 det =
+        (__int128)(adx * adx + ady * ady) * (bdx * cdy - cdx * bdy) +
+        (__int128)(bdx * bdx + bdy * bdy) * (cdx * ady - adx * cdy) +
+        (__int128)(cdx * cdx + cdy * cdy) * (adx * bdy - bdx * ady);
+    return det > 0;
+}
+
+/*
+ *  Finds a triangle containing vertex p, walking from triangle t (and
+ *  falling back to a search of every triangle if the walk goes on too long)
+ */
+static int32_t dt_locate(const Dt* d, uint32_t p, int32_t t)
+{
+    for (uint32_t step=0; step < d->tri_count; ++step)
+    {
+        const DtTri* T = &d->tri[t];
+        int32_t next = -1;
+        for (unsigned j=0; j < 3; ++j)
+        {
+            unsigned k = (j + step) % 3;
+            if (dt_orient(d, T->v[(k + 1) % 3], T->v[(k + 2) % 3], p) < 0)
+            {
+                next = T->n[k];
+                break;
+            }
+        }
+        if (next < 0)
+        {
+            return t;
+        }
+        t = next;
+    }
+
+    for (uint32_t u=0; u < d->tri_count; ++u)
+    {
+        const DtTri* T = &d->tri[u];
+        if (T->v[0] != UINT32_MAX &&
+            dt_orient(d, T->v[0], T->v[1], p) >= 0 &&
+            dt_orient(d, T->v[1], T->v[2], p) >= 0 &&
+            dt_orient(d, T->v[2], T->v[0], p) >= 0)
+        {
+            return u;
+        }
+    }
+    return t;
+}
+
+/*
+ *  Inserts vertex i, starting the search from triangle *hint and leaving
+ *  a triangle next to the new vertex there.  Returns false (leaving the
+ *  vertex out) if it duplicates an existing vertex.
+ */
+static bool dt_insert(Dt* d, uint32_t i, uint32_t stamp, int32_t* hint)
+{
+    int32_t t = dt_locate(d, i, *hint);
+    for (unsigned k=0; k < 3; ++k)
+    {
+        const int64_t* q = d->q[d->tri[t].v[k]];
+        if (q[0] == d->q[i][0] && q[1] == d->q[i][1])
+        {
+            return false;
+        }
+    }
+
+    /*  Collect the cavity:  the connected triangles whose circumcircles  *
+     *  contain p (marked 2 * stamp, and 2 * stamp + 1 if rejected)       */
+    uint32_t ncavity = 0, nstack = 0;
+    d->stack[nstack++] = t;
+    d->mark[t] = 2 * stamp;
+    while (nstack)
+    {
+        int32_t u = d->stack[--nstack];
+        d->cavity[ncavity++] = u;
+        for (unsigned k=0; k < 3; ++k)
+        {
+            int32_t m = d->tri[u].n[k];
+            if (m < 0 || d->mark[m] >= 2 * stamp)
+            {
+                continue;
+            }
+            const DtTri* M = &d->tri[m];
+            bool inside = dt_incircle(d, M->v[0], M->v[1], M->v[2], i);
+            d->mark[m] = 2 * stamp + !inside;
+            if (inside)
+            {
+                d->stack[nstack++] = m;
+            }
+        }
+    }
+
+    /*  Its boundary edges, each of which gets a triangle with p  */
+    uint32_t nedges = 0;
+    for (uint32_t j=0; j < ncavity; ++j)
+    {
+        const DtTri* U = &d->tri[d->cavity[j]];
+        for (unsigned k=0; k < 3; ++k)
+        {
+            if (U->n[k] < 0 || d->mark[U->n[k]] != 2 * stamp)
+            {
+                d->edges[nedges++] = (DtEdge){
+                    .a = U->v[(k + 1) % 3], .b = U->v[(k + 2) % 3],
+                    .out = U->n[k]};
+            }
+        }
+    }
+    for (uint32_t j=0; j < ncavity; ++j)
+    {
+        d->tri[d->cavity[j]].v[0] = UINT32_MAX;
+        d->unused[d->unused_count++] = d->cavity[j];
+    }
+
+    for (uint32_t j=0; j < nedges; ++j)
+    {
+        const DtEdge* e = &d->edges[j];
+        int32_t u;
+        if (d->unused_count)
+        {
+            u = d->unused[--d->unused_count];
+        }
+        else if (d->tri_count < d->tri_cap)
+        {
+            u = d->tri_count++;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Delaunay triangulation overflowed\n");
+            exit(-1);
+        }
+
+        d->tri[u] = (DtTri){.v = {e->a, e->b, i}, .n = {-1, -1, e->out}};
+        d->mark[u] = 0;
+        if (e->out >= 0)
+        {
+            /*  Match the shared edge by its vertices, since the outer  *
+             *  triangle's other neighbors may be reused cavity slots    */
+            DtTri* O = &d->tri[e->out];
+            for (unsigned k=0; k < 3; ++k)
+            {
+                if (O->v[(k + 1) % 3] == e->b)
+                {
+                    O->n[k] = u;
+                }
+            }
+        }
+        d->fan[e->a] = u;
+        d->corner[e->a] = d->corner[e->b] = d->corner[i] = u;
+    }
+
+    /*  Link the new triangles around p:  (a, b, p) shares its edge b-p   *
+     *  with the new triangle that starts at b                            */
+    for (uint32_t j=0; j < nedges; ++j)
+    {
+        int32_t u = d->fan[d->edges[j].a];
+        int32_t m = d->fan[d->edges[j].b];
+        d->tri[u].n[0] = m;
+        d->tri[m].n[1] = u;
+    }
+
+    *hint = d->corner[i];
+    return true;
+}
+
+/*
+ *  Returns the bucket of vertex i in a boustrophedon walk over a g x g grid
+ */
+static unsigned dt_key(const Dt* d, unsigned i, unsigned g)
+{
+    unsigned gx = fh_bucket(d->p[i][0] / d->cfg->width, g);
+    unsigned gy = fh_bucket(d->p[i][1] / d->cfg->height, g);
+    return gy * g + ((gy & 1) ? g - 1 - gx : gx);
+}
+
+/*
+ *  Sorts the seeds into a boustrophedon order over a grid of about four
+ *  seeds per cell, so that each insertion's walk starts near its target
+ */
+static void dt_order(Dt* d)
+{
+    const Config* c = d->cfg;
+    unsigned g = (unsigned)ceil(sqrt(c->samples / 4.0));
+    memset(d->bucket, 0, (g * g + 1) * sizeof(uint32_t));
+
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        d->bucket[dt_key(d, i, g) + 1]++;
+    }
+    for (unsigned b=0; b < g * g; ++b)
+    {
+        d->bucket[b + 1] += d->bucket[b];
+    }
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        d->order[d->bucket[dt_key(d, i, g)]++] = i;
+    }
+}
+
+/*
+ *  Rebuilds the triangulation of the given seeds, inserting them in spatial
+ *  order so that each walk is a few steps.  A seed that lands on another
+ *  one is nudged by a small fraction of a pixel, so that the two still get
+ *  a cell each (whose centroids then pull them apart).
+ */
+static void dt_build(Dt* d, const float (*pts)[3])
+{
+    const Config* c = d->cfg;
+    const unsigned n = c->samples;
+    for (unsigned i=0; i < n; ++i)
+    {
+        dt_place(d, i, pts[i][0] * c->width, pts[i][1] * c->height);
+        d->corner[i] = -1;
+    }
+
+    /*  The super triangle's vertices are ten image sizes away  */
+    const double m = 10.0 * fmax(c->width, c->height);
+    const double cx = c->width / 2.0, cy = c->height / 2.0;
+    dt_place(d, n, cx - 3 * m, cy - 3 * m);
+    dt_place(d, n + 1, cx + 3 * m, cy - 3 * m);
+    dt_place(d, n + 2, cx, cy + 3 * m);
+
+    d->tri[0] = (DtTri){.v = {n, n + 1, n + 2}, .n = {-1, -1, -1}};
+    d->corner[n] = d->corner[n + 1] = d->corner[n + 2] = 0;
+    d->tri_count = 1;
+    d->unused_count = 0;
+    memset(d->mark, 0, d->tri_cap * sizeof(uint32_t));
+
+    dt_order(d);
+    int32_t hint = 0;
+    uint32_t stamp = 0;
+    for (unsigned j=0; j < n; ++j)
+    {
+        const uint32_t i = d->order[j];
+        for (unsigned k=1; !dt_insert(d, i, ++stamp, &hint); ++k)
+        {
+            const double a = 2.399963 * (i + k);    /*  Golden angle  */
+            dt_place(d, i, d->p[i][0] + cos(a) / 256,
+                           d->p[i][1] + sin(a) / 256);
+            d->jitters++;
+        }
+    }
+    d->built = true;
+    d->rebuilds++;
+}
+
+/*
+ *  Points triangle m's link to triangle from at triangle to instead
+ */
+static void dt_relink(Dt* d, int32_t m, int32_t from, int32_t to)
+{
+    if (m < 0)
+    {
+        return;
+    }
+    for (unsigned k=0; k < 3; ++k)
+    {
+        if (d->tri[m].n[k] == from)
+        {
+            d->tri[m].n[k] = to;
+        }
+    }
+}
+
+/*
+ *  Flips the edge opposite vertex k of triangle t if the vertex across it
+ *  is inside t's circumcircle, in which case t becomes (a, b, e) and the
+ *  neighbor (a, e, c), where t was (a, b, c).  Returns true if it flipped.
+ */
+static bool dt_flip(Dt* d, int32_t t, unsigned k)
+{
+    const int32_t u = d->tri[t].n[k];
+    if (u < 0)
+    {
+        return false;
+    }
+    DtTri* T = &d->tri[t];
+    DtTri* U = &d->tri[u];
+    const unsigned l = (U->n[0] == t) ? 0 : (U->n[1] == t) ? 1 : 2;
+    const uint32_t a = T->v[k];
+    const uint32_t b = T->v[(k + 1) % 3];
+    const uint32_t c = T->v[(k + 2) % 3];
+    const uint32_t e = U->v[l];
+    if (!dt_incircle(d, a, b, c, e))
+    {
+        return false;
+    }
+
+    /*  An illegal edge always has a convex quadrilateral around it, so  *
+     *  both new triangles are counter-clockwise                         */
+    const int32_t be = U->n[(l + 1) % 3], ec = U->n[(l + 2) % 3];
+    const int32_t ca = T->n[(k + 1) % 3], ab = T->n[(k + 2) % 3];
+    *T = (DtTri){.v = {a, b, e}, .n = {be, u, ab}};
+    *U = (DtTri){.v = {a, e, c}, .n = {ec, ca, t}};
+    dt_relink(d, be, u, t);
+    dt_relink(d, ca, t, u);
+    d->corner[a] = d->corner[b] = d->corner[e] = t;
+    d->corner[c] = u;
+    return true;
+}
+
+static void dt_queue(Dt* d, int32_t t, uint32_t* nstack)
+{
+    if (!d->queued[t])
+    {
+        d->queued[t] = 1;
+        d->stack[(*nstack)++] = t;
+    }
+}
+
+/*
+ *  Moves the vertices to the given seeds and restores the Delaunay property
+ *  with edge flips.  Returns false, leaving the triangulation invalid, if a
+ *  move turned a triangle over (or flattened it, as when two seeds meet).
+ */
+static bool dt_update(Dt* d, const float (*pts)[3])
+{
+    const Config* c = d->cfg;
+    for (unsigned i=0; i < c->samples; ++i)
+    {
+        dt_place(d, i, pts[i][0] * c->width, pts[i][1] * c->height);
+    }
+
+    /*  With the super triangle fixed, the triangulation stays valid as  *
+     *  long as every triangle stays counter-clockwise                   */
+    uint32_t nstack = 0;
+    for (uint32_t t=0; t < d->tri_count; ++t)
+    {
+        const DtTri* T = &d->tri[t];
+        if (T->v[0] == UINT32_MAX)
+        {
+            continue;
+        }
+        if (dt_orient(d, T->v[0], T->v[1], T->v[2]) <= 0)
+        {
+            memset(d->queued, 0, d->tri_cap);
+            return false;
+        }
+        dt_queue(d, t, &nstack);
+    }
+
+    /*  Lawson's algorithm:  flip illegal edges until there are none  */
+    while (nstack)
+    {
+        const int32_t t = d->stack[--nstack];
+        d->queued[t] = 0;
+        for (unsigned k=0; k < 3; ++k)
+        {
+            if (dt_flip(d, t, k))
+            {
+                d->flips++;
+                dt_queue(d, t, &nstack);
+                dt_queue(d, d->tri[t].n[1], &nstack);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ *  Forces the next update to rebuild the triangulation (after the seeds
+ *  are renumbered or their count changes)
+ */
+void dt_reset(Dt* d)
+{
+    d->built = false;
+}
+
+/*
+ *  Clips a polygon (of n vertices) to the half-plane where the given axis
+ *  is on the given side of a limit, writing the result to out and
+ *  returning its vertex count
+ */
+static unsigned dt_clip(const double (*in)[2], unsigned n, double (*out)[2],
+                        unsigned axis, double limit, bool below)
+{
+    unsigned m = 0;
+    for (unsigned j=0; j < n; ++j)
+    {
+        const double* a = in[j];
+        const double* b = in[(j + 1) % n];
+        double da = below ? limit - a[axis] : a[axis] - limit;
+        double db = below ? limit - b[axis] : b[axis] - limit;
+
+        if (da >= 0)
+        {
+            out[m][0] = a[0];
+            out[m][1] = a[1];
+            m++;
+        }
+        if ((da >= 0) != (db >= 0))
+        {
+            double t = da / (da - db);
+            out[m][0] = a[0] + t * (b[0] - a[0]);
+            out[m][1] = a[1] + t * (b[1] - a[1]);
+            m++;
+        }
+    }
+    return m;
+}
+
+/*
+ *  Adds the line integrals along one counter-clockwise polygon edge, split
+ *  where it crosses pixel boundaries, to s (x * w, y * w, area, w; all in
+ *  pixels).  Within a piece the density comes from a single pixel, so
+ *  G(x) = integral of w from 0 to x along the row is linear and the
+ *  trapezoid and Simpson's rules are exact.
+ */
+static void dt_edge(const Dt* d, const double* a, const double* b,
+                    double s[4])
+{
+    const Config* c = d->cfg;
+    const size_t stride = c->width + 1;
+    const double dx = b[0] - a[0], dy = b[1] - a[1];
+    if (dy == 0)
+    {
+        return;     /*  Every integral here is taken over dy  */
+    }
+
+    /*  Parameters of the next crossings of a column and a row boundary  */
+    double tx = INFINITY, txs = INFINITY, ty, tys;
+    if (dx != 0)
+    {
+        double k = (dx > 0) ? floor(a[0]) + 1 : ceil(a[0]) - 1;
+        tx = (k - a[0]) / dx;
+        txs = 1 / fabs(dx);
+    }
+    {
+        double k = (dy > 0) ? floor(a[1]) + 1 : ceil(a[1]) - 1;
+        ty = (k - a[1]) / dy;
+        tys = 1 / fabs(dy);
+    }
+
+    double t0 = 0;
+    while (t0 < 1)
+    {
+        double t1 = fmin(1, fmin(tx, ty));
+        while (tx <= t1)    { tx += txs; }
+        while (ty <= t1)    { ty += tys; }
+
+        double x0 = a[0] + t0 * dx, y0 = a[1] + t0 * dy;
+        double x1 = a[0] + t1 * dx, y1 = a[1] + t1 * dy;
+        double xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+        t0 = t1;
+
+        int row = (int)floor(ym), col = (int)floor(xm);
+        row = row < 0 ? 0 : (row >= c->height ? c->height - 1 : row);
+        col = col < 0 ? 0 : (col >= c->width ? c->width - 1 : col);
+
+        const double* pw = &d->prefix_w[row * stride];
+        const double* pxw = &d->prefix_xw[row * stride];
+        const double w = pw[col + 1] - pw[col];
+
+        /*  Integrals of w and x * w along the row, from 0 to x  */
+        #define G(x)  (pw[col] + w * ((x) - col))
+        #define GX(x) (pxw[col] + w * ((x) * (x) - col * col) / 2)
+        const double h = y1 - y0;
+        s[0] += h * (GX(x0) + 4 * GX(xm) + GX(x1)) / 6;
+        s[1] += h * (y0 * G(x0) + 4 * ym * G(xm) + y1 * G(x1)) / 6;
+        s[2] += h * (x0 + x1) / 2;
+        s[3] += h * (G(x0) + G(x1)) / 2;
+        #undef G
+        #undef GX
+    }
+}
+
+/*
+ *  Integrates the density over the Voronoi cell of seed i, clipped to the
+ *  image, using the given polygon buffers
+ */
+static void dt_cell(const Dt* d, uint32_t i, double (*poly)[2],
+                    double (*tmp)[2], double s[4])
+{
+    const Config* c = d->cfg;
+    s[0] = s[1] = s[2] = s[3] = 0;
+    int32_t t = d->corner[i];
+    if (t < 0)
+    {
+        return;     /*  Not in the triangulation  */
+    }
+
+    /*  Collect the circumcenters of the triangles around the seed, in    *
+     *  counter-clockwise order:  the next triangle is across the edge    *
+     *  leaving the seed to its left                                      */
+    unsigned n = 0;
+    const int32_t first = t;
+    do
+    {
+        const DtTri* T = &d->tri[t];
+        unsigned k = (T->v[0] == i) ? 0 : (T->v[1] == i) ? 1 : 2;
+        const double* a = d->p[T->v[0]];
+        const double* b = d->p[T->v[1]];
+        const double* q = d->p[T->v[2]];
+
+        const double bx = b[0] - a[0], by = b[1] - a[1];
+        const double qx = q[0] - a[0], qy = q[1] - a[1];
+        const double det = 2 * (bx * qy - by * qx);
+        const double bb = bx * bx + by * by, qq = qx * qx + qy * qy;
+        poly[n][0] = a[0] + (qy * bb - by * qq) / det;
+        poly[n][1] = a[1] + (bx * qq - qx * bb) / det;
+        n++;
+
+        t = T->n[(k + 1) % 3];
+    } while (t != first && t >= 0 && n < d->poly_cap - 8);
+
+    n = dt_clip((const double (*)[2])poly, n, tmp, 0, 0, false);
+    n = dt_clip((const double (*)[2])tmp, n, poly, 0, c->width, true);
+    n = dt_clip((const double (*)[2])poly, n, tmp, 1, 0, false);
+    n = dt_clip((const double (*)[2])tmp, n, poly, 1, c->height, true);
+
+    for (unsigned j=0; j < n; ++j)
+    {
+        dt_edge(d, poly[j], poly[(j + 1) % n], s);
+    }
+}
+
+static void dt_cells(void* data, unsigned i)
+{
+    const Dt* d = (const Dt*)data;
+    const unsigned n = d->cfg->samples;
+    const unsigned block = (n + d->cfg->threads - 1) / d->cfg->threads;
+
+    double (*poly)[2] = &d->poly[2 * i * d->poly_cap];
+    double (*tmp)[2] = poly + d->poly_cap;
+    for (unsigned s=i * block; s < n && s < (i + 1) * block; ++s)
+    {
+        if (d->frozen && d->frozen[s])
+        {
+            continue;
+        }
+        double r[4];
+        dt_cell(d, s, poly, tmp, r);
+
+        /*  Store the integrals in the summation texture's layout, with  *
+         *  the cell's area in place of its pixel count                  */
+        d->sums[s][0] = r[0] / d->cfg->width;
+        d->sums[s][1] = r[1] / d->cfg->height;
+        d->sums[s][2] = r[2];
+        d->sums[s][3] = r[3];
+    }
+}
+
+/*
+ *  Triangulates the seeds (repairing the previous triangulation where
+ *  possible) and integrates the density over their cells
+ */
+void dt_integrate(Dt* d, const float (*pts)[3])
+{
+    if (!d->built || !dt_update(d, pts))
+    {
+        dt_build(d, pts);
+    }
+    d->updates++;
+    parallel_for(d->cfg->threads, dt_cells, d);
+}
+
+void dt_report(const Dt* d)
+{
+    fprintf(stderr, "Delaunay: %lu rebuilds in %lu iterations, %.1f edge"
+                    " flips per iteration",
+            d->rebuilds, d->updates,
+            (double)d->flips / (d->updates ? d->updates : 1));
+    if (d->jitters)
+    {
+        fprintf(stderr, ", %lu duplicate seeds nudged", d->jitters);
+    }
+    fprintf(stderr, "\n");
+}
+
+void dt_free(Dt* d)
+{
+    free(d->p);
+    free(d->q);
+    free(d->corner);
+    free(d->order);
+    free(d->bucket);
+    free(d->tri);
+    free(d->mark);
+    free(d->stack);
+    free(d->cavity);
+    free(d->unused);
+    free(d->edges);
+    free(d->fan);
+    free(d->queued);
+    free(d->prefix_w);
+    free(d->prefix_xw);
+    free(d->poly);
+    free(d);
+}
+
+/******************************************************************************/
+
+/*
+ *  Adaptive-count stippling, after weighted Linde-Buzo-Gray:  every cell
+ *  should carry the mass of one full-size dot (a full-black disk of the
+ *  stipple radius), so after each update, cells lighter than a band around
+ *  that mass are removed and cells heavier than it are split in two, about
+ *  their centroids.  The band widens every iteration so that the count
+ *  settles; once an update changes nothing, the count is fixed and the
+ *  remaining iterations are plain Lloyd.  The count starts at -n, and the
+ *  backend is built with room for twice the count that the image's total
+ *  mass calls for.
+ */
+#define LBG_HYSTERESIS 0.6          /*  Initial band width, relative  */
+#define LBG_HYSTERESIS_STEP 0.01    /*  Widening per iteration         */
+
+typedef struct Lbg_
+{
+    Config* cfg;            /*  Non-const, for its seed count and       *
+                             *  random generator                        */
+    unsigned capacity;      /*  Most seeds the backend has room for     */
+    double target;          /*  Mass of one full-size dot               */
+    float (*cells)[2];      /*  Mass and pixels of each cell            */
+    float (*next)[3];       /*  Scratch for the updated seeds           */
+    int settled;            /*  Iterations before an update changed     *
+                             *  nothing (fixing the count), or 0        */
+
+    unsigned long splits;
+    unsigned long removals;
+    unsigned long refused;  /*  Splits skipped for lack of capacity     */
+} Lbg;
+
+Lbg* lbg_new(Config* c)
+{
+    Lbg* l = (Lbg*)calloc(1, sizeof(Lbg));
+    l->cfg = c;
+
+    const double r = c->radius * fmin(c->sx, c->sy) *
+                     fmin(c->width, c->height);
+    l->target = M_PI * r * r;
+
+    double total = 0;
+    for (size_t i=0; i < (size_t)c->width * c->height; ++i)
+    {
+        total += 0.01 + 0.99 * (1.0 - c->img[i] / 255.0);
+    }
+    const double want = 2 * ceil(total / l->target);
+    l->capacity = (unsigned)fmin(fmax(want, c->samples), UINT16_MAX);
+    fprintf(stderr, "LBG: %.1f px^2 per stipple, room for %u stipples\n",
+            l->target, l->capacity);
+
+    l->cells = (float (*)[2])calloc(l->capacity, sizeof(*l->cells));
+    l->next = (float (*)[3])malloc(l->capacity * sizeof(*l->next));
+    return l;
+}
+
+/*
+ *  Removes and splits cells (given l->cells, with the seeds at their
+ *  centroids), compacting the seeds and updating the seed count.  Split
+ *  seeds keep one half in place and append the other.  Returns the number
+ *  of cells removed or split.
+ */
+unsigned lbg_update(Lbg* l, float (*pts)[3])
+{
+    Config* c = l->cfg;
+    if (l->settled)
+    {
+        return 0;
+    }
+
+    const unsigned n = c->samples;
+    const double h = LBG_HYSTERESIS + LBG_HYSTERESIS_STEP * c->step;
+    const double lower = (1 - h / 2) * l->target;
+    const double upper = (1 + h / 2) * l->target;
+
+    unsigned light = 0, heavy = 0;
+    for (unsigned i=0; i < n; ++i)
+    {
+        light += l->cells[i][0] < lower;
+        heavy += l->cells[i][0] > upper;
+    }
+
+    /*  Never remove every seed, nor split past the capacity  */
+    const bool remove = light < n;
+    const unsigned kept = remove ? n - light : n;
+    const unsigned splits = heavy < l->capacity - kept ? heavy
+                                                       : l->capacity - kept;
+
+    unsigned out = 0, split = 0;
+    for (unsigned i=0; i < n; ++i)
+    {
+        const float mass = l->cells[i][0];
+        if (remove && mass < lower)
+        {
+            continue;
+        }
+
+        memcpy(l->next[out], pts[i], sizeof(*pts));
+        if (mass > upper && split < splits)
+        {
+            /*  Half the radius of a disk with the cell's area  */
+            const float r = 0.5f * sqrtf(l->cells[i][1] / (float)M_PI);
+            const float a = config_rand(c) * (float)(2 * M_PI / 4294967296.0);
+            const float dx = r * cosf(a) / c->width;
+            const float dy = r * sinf(a) / c->height;
+
+            float* p = l->next[kept + split++];
+            p[0] = fminf(fmaxf(pts[i][0] + dx, 0.0f), 1.0f);
+            p[1] = fminf(fmaxf(pts[i][1] + dy, 0.0f), 1.0f);
+            p[2] = pts[i][2];
+            l->next[out][0] = fminf(fmaxf(pts[i][0] - dx, 0.0f), 1.0f);
+            l->next[out][1] = fminf(fmaxf(pts[i][1] - dy, 0.0f), 1.0f);
+        }
+        out++;
+    }
+
+    c->samples = (uint16_t)(kept + splits);
+    memcpy(pts, l->next, c->samples * sizeof(*pts));
+
+    const unsigned removed = remove ? light : 0;
+    l->splits += splits;
+    l->removals += removed;
+    l->refused += heavy - splits;
+    l->settled = (!removed && !splits) ? c->step + 1 : 0;
+    return removed + splits;
+}
+
+void lbg_report(const Lbg* l)
+{
+    if (l->settled)
+    {
+        fprintf(stderr, "LBG: %u stipples, settled after %i iterations",
+                l->cfg->samples, l->settled);
+    }
+    else
+    {
+        fprintf(stderr, "LBG: %u stipples, still changing",
+                l->cfg->samples);
+    }
+    fprintf(stderr, " (%lu splits, %lu removals)%s\n",
+            l->splits, l->removals, l->refused ? ", capacity reached" : "");
+}
+
+void lbg_free(Lbg* l)
+{
+    free(l->cells);
+    free(l->next);
+    free(l);
+}
+
+/******************************************************************************/
+
+/*
+ *  Reads back the GPU's updated seeds, reseeding empty cells or updating
+ *  the LBG seed count, which set the frozen cells for the next summation
+ *  and the regions to redraw in the next labelling.  This waits for the
+ *  feedback pass to finish.
+ */
+void seeds_sync(Config* c, Voronoi* v, Sum* s, Feedback* f, Reseed* e,
+                Lbg* l, Freeze* z, Dirty* d, float (*pts)[3])
+{
+    glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, c->samples * sizeof(*pts), pts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (e)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, f->cells);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0,
+                           c->samples * sizeof(*e->cells), e->cells);
+        if (reseed_update(e, pts))
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+            glBufferSubData(GL_ARRAY_BUFFER, 0,
+                            c->samples * sizeof(*pts), pts);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    /*  Subsampled iterations underweigh every cell, so they're skipped  */
+    if (l && c->step >= c->subsample)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, f->cells);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0,
+                           c->samples * sizeof(*l->cells), l->cells);
+        if (lbg_update(l, pts))
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+            glBufferSubData(GL_ARRAY_BUFFER, 0,
+                            c->samples * sizeof(*pts), pts);
+
+            /*  The seeds are renumbered, so the previous cells' boxes  *
+             *  no longer apply                                          */
+            if (v->bounds)
+            {
+                const GLfloat empty[4] = {1e9f, 1e9f, 1e9f, 1e9f};
+                glBindFramebuffer(GL_FRAMEBUFFER, v->bounds_fbo);
+                glClearBufferfv(GL_COLOR, 0, empty);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    if (z)
+    {
+        freeze_update(z, (const float (*)[3])pts);
+        sum_freeze(c, s, z->frozen);
+    }
+    if (d)
+    {
+        dirty_update(d, (const float (*)[3])pts);
+        v->rects = d->rects;
+        v->rect_count = d->rect_count;
+        v->partial = d->partial;
+    }
+}
+
+/*
+ *  Sorts the GPU's seeds along a Hilbert curve, renumbering everything
+ *  that is kept per seed.  The label texture still holds the old numbers,
+ *  so the next labelling redraws all of it.
+ */
+void seeds_reorder(Config* c, Voronoi* v, Sum* s, Freeze* z, Dirty* d,
+                   float (*pts)[3])
+{
+    const size_t bytes = c->samples * sizeof(*pts);
+    glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
+
+    uint32_t* perm = seeds_hilbert(c, (const float (*)[3])pts);
+    seeds_permute(c, perm, pts, sizeof(*pts));
+    seeds_permute(c, perm, c->order, sizeof(*c->order));
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    /*  The previous cells' bounding boxes are per seed too  */
+    if (v->bounds)
+    {
+        float (*b)[4] = (float (*)[4])malloc(c->samples * sizeof(*b));
+        glBindTexture(GL_TEXTURE_2D, v->bounds);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, b);
+        seeds_permute(c, perm, b, sizeof(*b));
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, c->samples, 1,
+                        GL_RGBA, GL_FLOAT, b);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        free(b);
+    }
+
+    if (z)
+    {
+        freeze_permute(z, perm);
+        sum_freeze(c, s, z->frozen);
+    }
+    if (d)
+    {
+        seeds_permute(c, perm, d->prev, sizeof(*d->prev));
+        grid_reset(d->grid);
+    }
+    v->partial = false;
+    free(perm);
+}
+
+/******************************************************************************/
+
+/*
+ *  The CPU backend runs the whole iteration without OpenGL:  it labels the
+ *  pixels with the Felzenszwalb-Huttenlocher labeller, then sums each cell
+ *  into per-thread accumulators (so threads never share a cell's sums),
+ *  which are reduced to move the seeds to their centroids.  The grid
+ *  backend labels and sums in one pass over tiles, into the same
+ *  per-thread accumulators.  The Delaunay backend replaces labelling and
+ *  summation with exact cell integrals, written to a single block of
+ *  accumulators.  With --batch, the minibatch solver replaces the whole
+ *  iteration, using the grid to find nearest seeds.
+ */
+typedef struct Cpu_
+{
+    const Config* cfg;
+    float (*pts)[3];        /*  Seed positions (0 to 1) and weights     */
+    Fh* fh;
+    Grid* grid;
+    Mb* mb;
+    Dt* dt;
+    Freeze* freeze;
+    Reseed* reseed;
+    Lbg* lbg;
+    float (*cells)[2];      /*  Each cell's mass and pixels (for        *
+                             *  reseeding or LBG), or NULL              */
+    double (*sums)[4];      /*  Per-block sums, blocks x samples        */
+    unsigned blocks;
+} Cpu;
+
+Cpu* cpu_new(Config* c)
+{
+    Cpu* u = (Cpu*)calloc(1, sizeof(Cpu));
+    u->cfg = c;
+
+    /*  With LBG, everything is sized for its capacity  */
+    const uint16_t samples = c->samples;
+    if (c->lbg)
+    {
+        u->lbg = lbg_new(c);
+        c->samples = (uint16_t)u->lbg->capacity;
+    }
+
+    u->pts = (float (*)[3])seeds_new(c);
+    u->blocks = (c->backend == BACKEND_DELAUNAY) ? 1 : c->threads;
+    u->sums = (double (*)[4])malloc(
+            u->blocks * c->samples * sizeof(*u->sums));
+    if (c->backend == BACKEND_DELAUNAY)
+    {
+        u->dt = dt_new(c, u->sums);
+    }
+    else if (c->backend == BACKEND_GRID || c->batch)
+    {
+        u->grid = grid_new(c, u->sums);
+    }
+    else
+    {
+        u->fh = fh_new(c);
+    }
+
+    if (c->batch)
+    {
+        u->mb = mb_new(c, u->grid);
+    }
+    if (c->backend == BACKEND_GRID)
+    {
+        fprintf(stderr, "Grid labeller kernel: %s\n", u->grid->kernel);
+    }
+
+    if (c->freeze)
+    {
+        u->freeze = freeze_new(c, u->grid ? u->grid : grid_new(c, NULL));
+        if (u->grid)
+        {
+            u->grid->frozen = u->freeze->frozen;
+        }
+        if (u->dt)
+        {
+            u->dt->frozen = u->freeze->frozen;
+        }
+    }
+    if (c->reseed)
+    {
+        u->reseed = reseed_new(c);
+    }
+    c->samples = samples;
+
+    u->cells = u->reseed ? u->reseed->cells : u->lbg ? u->lbg->cells : NULL;
+    return u;
+}
+
+void cpu_free(Cpu* u)
+{
+    if (u->freeze)
+    {
+        /*  The active set has its own grid if the backend has none  */
+        if (u->freeze->grid != u->grid)
+        {
+            grid_free(u->freeze->grid);
+        }
+        freeze_free(u->freeze);
+    }
+    if (u->mb)
+    {
+        mb_free(u->mb);
+    }
+    if (u->fh)
+    {
+        fh_free(u->fh);
+    }
+    if (u->grid)
+    {
+        grid_free(u->grid);
+    }
+    if (u->dt)
+    {
+        dt_free(u->dt);
+    }
+    if (u->reseed)
+    {
+        reseed_free(u->reseed);
+    }
+    if (u->lbg)
+    {
+        lbg_free(u->lbg);
+    }
+    free(u->pts);
+    free(u->sums);
+    free(u);
+}
+
+/*
+ *  Sums this thread's block of rows into its own accumulators, in the
+ *  summation texture's layout (x * w, y * w, count, w)
+ */
+void cpu_sum(void* data, unsigned t)
+{
+    Cpu* u = (Cpu*)data;
+    const Config* c = u->cfg;
+    double (*sums)[4] = &u->sums[t * c->samples];
+    memset(sums, 0, c->samples * sizeof(*sums));
+
+    unsigned y0 = c->height * t / c->threads;
+    unsigned y1 = c->height * (t + 1) / c->threads;
+    for (unsigned y=y0; y < y1; ++y)
+    {
+        for (unsigned x=0; x < c->width; ++x)
+        {
+            size_t i = (size_t)y * c->width + x;
+            double w = 0.01 + 0.99 * (1.0 - c->img[i] / 255.0);
+            double* s = sums[u->fh->labels[i]];
+            s[0] += w * (x + 0.5) / c->width;
+            s[1] += w * (y + 0.5) / c->height;
+            s[2] += 1;
+            s[3] += w;
+        }
+    }
+}
+
+/*
+ *  Reduces the per-thread sums for this thread's block of cells and moves
+ *  their seeds, matching the GPU's feedback pass
+ */
+void cpu_move(void* data, unsigned t)
+{
+    Cpu* u = (Cpu*)data;
+    const Config* c = u->cfg;
+
+    unsigned i0 = c->samples * t / c->threads;
+    unsigned i1 = c->samples * (t + 1) / c->threads;
+    for (unsigned i=i0; i < i1; ++i)
+    {
+        double s[4] = {0, 0, 0, 0};
+        for (unsigned j=0; j < u->blocks; ++j)
+        {
+            for (unsigned k=0; k < 4; ++k)
+            {
+                s[k] += u->sums[j * c->samples + i][k];
+            }
+        }
+
+        /*  A cell that covers no pixels (or is frozen) keeps its seed  */
+        const bool frozen = u->freeze && u->freeze->frozen[i];
+        if (s[2] > 0 && !frozen)
+        {
+            u->pts[i][0] = s[0] / s[3];
+            u->pts[i][1] = s[1] / s[3];
+            u->pts[i][2] = s[3] / s[2];
+        }
+        if (u->cells)
+        {
+            u->cells[i][0] = frozen ? -1.0f : (float)s[3];
+            u->cells[i][1] = (float)s[2];
+        }
+    }
+}
+
+/*
+ *  Sorts the seeds along a Hilbert curve, renumbering everything that is
+ *  kept per seed
+ */
+void cpu_reorder(Cpu* u)
+{
+    const Config* c = u->cfg;
+    uint32_t* perm = seeds_hilbert(c, (const float (*)[3])u->pts);
+    seeds_permute(c, perm, u->pts, sizeof(*u->pts));
+    seeds_permute(c, perm, c->order, sizeof(*c->order));
+
+    if (u->grid)
+    {
+        grid_reset(u->grid);
+    }
+    if (u->dt)
+    {
+        dt_reset(u->dt);
+    }
+    if (u->freeze)
+    {
+        freeze_permute(u->freeze, perm);
+    }
+    if (u->mb)
+    {
+        seeds_permute(c, perm, u->mb->seen, sizeof(*u->mb->seen));
+        seeds_permute(c, perm, u->mb->inv_w, sizeof(*u->mb->inv_w));
+    }
+    free(perm);
+}
+
+void cpu_step(Cpu* u)
+{
+    if (u->mb)
+    {
+        mb_step(u->mb, u->pts);
+        return;
+    }
+    else if (u->dt)
+    {
+        dt_integrate(u->dt, (const float (*)[3])u->pts);
+    }
+    else if (u->grid)
+    {
+        grid_label(u->grid, (const float (*)[3])u->pts);
+    }
+    else
+    {
+        fh_label(u->fh, (const float (*)[3])u->pts);
+        parallel_for(u->cfg->threads, cpu_sum, u);
+    }
+    parallel_for(u->cfg->threads, cpu_move, u);
+
+    if (u->reseed)
+    {
+        reseed_update(u->reseed, u->pts);
+    }
+    if (u->lbg && lbg_update(u->lbg, u->pts))
+    {
+        if (u->grid)
+        {
+            grid_reset(u->grid);
+        }
+        if (u->dt)
+        {
+            dt_reset(u->dt);
+        }
+    }
+    if (u->freeze)
+    {
+        freeze_update(u->freeze, (const float (*)[3])u->pts);
+    }
+}
+
+/******************************************************************************/
+
+#define READBACK_RING 4
+
+/*
+ *  A ring of buffers used to copy the seed positions off the GPU without
+ *  stalling:  each slot gets a buffer-to-buffer copy and a fence, and is
+ *  only mapped once the fence has signalled.
+ */
+typedef struct Readback_
+{
+    GLuint buf[READBACK_RING];
+    GLsync fence[READBACK_RING];
+    int step[READBACK_RING];    /*  Iteration at which the copy was made   */
+    uint64_t rng[READBACK_RING];    /*  RNG state when the copy was made   */
+
+    unsigned head;  /*  Next slot to be filled  */
+    unsigned tail;  /*  Oldest pending slot     */
+    size_t bytes;   /*  Size of each buffer     */
+
+    unsigned dropped;   /*  Copies skipped because the ring was full  */
+} Readback;
+
+Readback* readback_new(size_t bytes)
+{
+    Readback* r = (Readback*)calloc(1, sizeof(Readback));
+    r->bytes = bytes;
+
+    glGenBuffers(READBACK_RING, r->buf);
+    for (unsigned i=0; i < READBACK_RING; ++i)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, r->buf[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    return r;
+}
+
+/*
+ *  Queues a copy of the given buffer.  If every slot is still in flight,
+ *  the copy is dropped rather than waiting on the GPU.
+ */
+void readback_push(Readback* r, GLuint src, int step, uint64_t rng)
+{
+    if (r->head - r->tail == READBACK_RING)
+    {
+        r->dropped++;
+        return;
+    }
+
+    unsigned i = r->head % READBACK_RING;
+    glBindBuffer(GL_COPY_READ_BUFFER, src);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, r->buf[i]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        0, 0, r->bytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    r->fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->step[i] = step;
+    r->rng[i] = rng;
+    r->head++;
+}
+
+/*
+ *  Maps the oldest pending copy if it is ready (or unconditionally if wait
+ *  is true), returning NULL otherwise.  A successful map must be followed
+ *  by readback_release before the next call.
+ */
+const void* readback_poll(Readback* r, bool wait, int* step, uint64_t* rng)
+{
+    if (r->head == r->tail)
+    {
+        return NULL;
+    }
+
+    unsigned i = r->tail % READBACK_RING;
+    GLenum status = glClientWaitSync(r->fence[i], GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        return NULL;
+    }
+
+    glDeleteSync(r->fence[i]);
+    *step = r->step[i];
+    *rng = r->rng[i];
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, r->buf[i]);
+    return glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, r->bytes,
+                            GL_MAP_READ_BIT);
+}
+
+void readback_release(Readback* r)
+{
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    r->tail++;
+}
+
+/******************************************************************************/
+
+/*
+ *  Live seed frames are written to a file descriptor as a 16-byte header
+ *  (the magic "SWLF", uint32 iteration, uint32 seed count, uint16 width
+ *  and height), followed by count (x, y, weight) float triples in the
+ *  0-1 range.  All values are in host byte order.
+ */
+typedef struct StreamHeader_
+{
+    char magic[4];
+    uint32_t step;
+    uint32_t count;
+    uint16_t width, height;
+} StreamHeader;
+
+/*
+ *  Writes a frame to the stream descriptor.  If the reader has gone away,
+ *  streaming is disabled rather than aborting the run.
+ */
+void stream_write(Config* c, int step, const float (*pts)[3])
+{
+    StreamHeader h = {
+        .magic = {'S', 'W', 'L', 'F'},
+        .step = (uint32_t)step,
+        .count = c->samples,
+        .width = c->out_width,
+        .height = c->out_height};
+
+    float* unordered = c->order ? seeds_unordered(c, pts) : NULL;
+    const void* chunks[2] = {&h, unordered ? unordered : (const float*)pts};
+    size_t sizes[2] = {sizeof(h), 3 * sizeof(float) * c->samples};
+
+    for (unsigned i=0; i < 2; ++i)
+    {
+        const char* data = (const char*)chunks[i];
+        size_t remaining = sizes[i];
+        while (remaining)
+        {
+            ssize_t n = write(c->stream, data, remaining);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else if (n < 0)
+            {
+                perror("Seed stream failed");
+                c->stream = -1;
+                free(unordered);
+                return;
+            }
+            data += n;
+            remaining -= n;
+        }
+    }
+    free(unordered);
+}
+
+/*
+ *  Writes every completed readback to the seed stream
+ */
+void stream_drain(Config* c, Readback* r, bool wait)
+{
+    int step;
+    uint64_t rng;
+    const void* pts;
+    while ((pts = readback_poll(r, wait, &step, &rng)))
+    {
+        if (c->stream != -1)
+        {
+            stream_write(c, step, (const float (*)[3])pts);
+        }
+        readback_release(r);
+    }
+}
+
+/*
+ *  Queues a frame of the current seeds if one is due at this iteration,
+ *  then forwards any frames that have finished copying
+ */
+void stream_update(Config* c, Readback* r, Voronoi* v)
+{
+    if (c->stream != -1 && c->step % c->stream_every == 0)
+    {
+        readback_push(r, v->pts, c->step, c->rng);
+    }
+    stream_drain(c, r, false);
+}
+
+/******************************************************************************/
+
+/*
+ *  Checkpoints are a 32-byte header followed by count (x, y, weight) float
+ *  triples, in host byte order.  They are written to a temporary file and
+ *  renamed into place, so a checkpoint on disk is always complete.
+ */
+#define CHECKPOINT_VERSION 1
+
+typedef struct CheckpointHeader_
+{
+    char magic[4];      /*  "SWLC"  */
+    uint32_t count;     /*  Number of seeds         */
+    uint64_t hash;      /*  Config::hash of the job */
+    uint64_t rng;       /*  Config::rng             */
+    uint32_t step;      /*  Completed iterations    */
+    uint32_t version;
+} CheckpointHeader;
+
+bool checkpoint_save(const char* path, const CheckpointHeader* h,
+                     const float (*pts)[3])
+{
+    size_t len = strlen(path);
+    char* tmp = (char*)malloc(len + 5);
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    FILE* f = fopen(tmp, "wb");
+    bool ok = f != NULL;
+    if (ok)
+    {
+        ok = fwrite(h, sizeof(*h), 1, f) == 1 &&
+             fwrite(pts, 3 * sizeof(float), h->count, f) == h->count &&
+             fflush(f) == 0 && fsync(fileno(f)) == 0;
+        ok = (fclose(f) == 0) && ok;
+    }
+    ok = ok && rename(tmp, path) == 0;
+
+    if (!ok)
+    {
+        perror("Checkpoint failed");
+        remove(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+/*
+ *  Loads a checkpoint into the given array (which must have room for
+ *  c->samples seeds), restoring the RNG state and returning the number of
+ *  completed iterations.  Exits if the checkpoint doesn't match the job.
+ */
+int checkpoint_load(const char* path, Config* c, float (*pts)[3])
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        perror("Failed to open checkpoint");
+        exit(-1);
+    }
+
+    CheckpointHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "SWLC", 4) ||
+        h.version != CHECKPOINT_VERSION)
+    {
+        fprintf(stderr, "Error: %s is not a valid checkpoint\n", path);
+        exit(-1);
+    }
+    else if (h.hash != c->hash || h.count != c->samples)
+    {
+        fprintf(stderr, "Error: checkpoint %s was made with a different "
+                        "image or settings\n", path);
+        exit(-1);
+    }
+    else if (fread(pts, 3 * sizeof(float), h.count, f) != h.count)
+    {
+        fprintf(stderr, "Error: checkpoint %s is truncated\n", path);
+        exit(-1);
+    }
+
+    fclose(f);
+    c->rng = h.rng;
+    return h.step;
+}
+
+/*
+ *  Periodic checkpoints are copied off the GPU through a readback ring,
+ *  then handed to a writer thread so that disk I/O never blocks the
+ *  iteration loop.  If a new checkpoint arrives before the previous one
+ *  has started writing, the older one is discarded.
+ */
+typedef struct Checkpoint_
+{
+    Readback* readback;
+    const char* path;
+    uint32_t count;     /*  Number of seeds  */
+    uint64_t hash;      /*  Config::hash     */
+    const uint32_t* order;  /*  Config::order    */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    CheckpointHeader header;    /*  Header for the pending checkpoint   */
+    float (*pending)[3];        /*  Pending seed positions, or NULL     */
+    bool writing;               /*  Set while the thread is writing     */
+    bool quit;
+} Checkpoint;
+
+void* checkpoint_thread(void* data)
+{
+    Checkpoint* k = (Checkpoint*)data;
+
+    pthread_mutex_lock(&k->lock);
+    while (true)
+    {
+        while (!k->pending && !k->quit)
+        {
+            pthread_cond_wait(&k->cond, &k->lock);
+        }
+        if (!k->pending)
+        {
+            break;
+        }
+
+        float (*pts)[3] = k->pending;
+        CheckpointHeader h = k->header;
+        k->pending = NULL;
+        k->writing = true;
+        pthread_mutex_unlock(&k->lock);
+
+        checkpoint_save(k->path, &h, (const float (*)[3])pts);
+        free(pts);
+
+        pthread_mutex_lock(&k->lock);
+        k->writing = false;
+        pthread_cond_broadcast(&k->cond);
+    }
+    pthread_mutex_unlock(&k->lock);
+
+    return NULL;
+}
+
+Checkpoint* checkpoint_new(const Config* c)
+{
+    Checkpoint* k = (Checkpoint*)calloc(1, sizeof(Checkpoint));
+    k->path = c->checkpoint;
+    k->count = c->samples;
+    k->hash = c->hash;
+    k->order = c->order;
+    k->readback = (c->backend == BACKEND_GPU)
+        ? readback_new(3 * sizeof(float) * c->samples) : NULL;
+
+    pthread_mutex_init(&k->lock, NULL);
+    pthread_cond_init(&k->cond, NULL);
+    pthread_create(&k->thread, NULL, checkpoint_thread, k);
+
+    return k;
+}
+
+void checkpoint_submit(Checkpoint* k, int step, uint64_t rng,
+                       const float (*pts)[3])
+{
+    size_t bytes = 3 * sizeof(float) * k->count;
+    float (*copy)[3] = (float (*)[3])malloc(bytes);
+
+    /*  Seeds are saved in their original order  */
+    for (uint32_t i=0; i < k->count; ++i)
+    {
+        memcpy(copy[k->order ? k->order[i] : i], pts[i], sizeof(*copy));
+    }
+
+    pthread_mutex_lock(&k->lock);
+    free(k->pending);
+    k->pending = copy;
+    k->header = (CheckpointHeader){
+        .magic = {'S', 'W', 'L', 'C'},
+        .count = k->count,
+        .hash = k->hash,
+        .rng = rng,
+        .step = (uint32_t)step,
+        .version = CHECKPOINT_VERSION};
+    pthread_cond_broadcast(&k->cond);
+    pthread_mutex_unlock(&k->lock);
+}
+
+/*
+ *  Blocks until every queued checkpoint has been written to disk
+ */
+void checkpoint_flush(Checkpoint* k)
+{
+    int step;
+    uint64_t rng;
+    const void* pts;
+    while (k->readback && (pts = readback_poll(k->readback, true, &step, &rng)))
+    {
+        checkpoint_submit(k, step, rng, pts);
+        readback_release(k->readback);
+    }
+
+    pthread_mutex_lock(&k->lock);
+    while (k->pending || k->writing)
+    {
+        pthread_cond_wait(&k->cond, &k->lock);
+    }
+    pthread_mutex_unlock(&k->lock);
+}
+
+/*
+ *  Queues a checkpoint if one is due at this iteration, then passes any
+ *  completed copies to the writer thread
+ */
+void checkpoint_update(Config* c, Checkpoint* k, Voronoi* v)
+{
+    if (c->step % c->checkpoint_every == 0)
+    {
+        readback_push(k->readback, v->pts, c->step, c->rng);
+    }
+
+    int done;
+    uint64_t rng;
+    const void* pts;
+    while ((pts = readback_poll(k->readback, false, &done, &rng)))
+    {
+        checkpoint_submit(k, done, rng, pts);
+        readback_release(k->readback);
+    }
+}
+
+/*
+ *  Synchronously writes a checkpoint of the current state (used when the
+ *  process is asked to terminate)
+ */
+void checkpoint_now(Config* c, Checkpoint* k, Voronoi* v)
+{
+    checkpoint_flush(k);
+
+    size_t bytes = 3 * sizeof(float) * c->samples;
+    float (*pts)[3] = (float (*)[3])malloc(bytes);
+    glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    teardown(viewport);
+    checkpoint_submit(k, c->step, c->rng, (const float (*)[3])pts);
+    checkpoint_flush(k);
+    free(pts);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-
-typedef struct Feedback_
-{
-    GLuint vao;
-    GLuint prog;
-} Feedback;
+/******************************************************************************/
 
-GLuint feedback_indices(uint16_t samples)
+/*
+ *  Returns monotonic wall-clock time in seconds
+ */
+double wall_time()
 {
-    GLuint vao;
-    GLuint vbo;
-    size_t bytes = sizeof(GLuint) * samples;
-    GLuint* indices = (GLuint*)malloc(bytes);
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
 
-    for (uint16_t i=0; i < samples; ++i)
-    {
-        indices[i] = i;
-    }
+#define TIMER_RING 4
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
+/*
+ *  Measures GPU time per iteration with a ring of timer queries, which are
+ *  read back only once their results are available.  This is used to
+ *  predict whether another iteration fits in the time budget.
+ */
+typedef struct Timer_
+{
+    GLuint query[TIMER_RING];
+    unsigned head;  /*  Next query to issue             */
+    unsigned tail;  /*  Oldest query still in flight    */
 
-    glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, bytes, indices, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, 0);
-    glBindVertexArray(0);
+    double recent[TIMER_RING];  /*  Most recent iteration times (seconds) */
+    unsigned measured;          /*  Number of completed measurements      */
 
-    free(indices);
+    double start;   /*  Wall-clock time at which the budget started  */
+} Timer;
 
-    return vao;
+Timer* timer_new(double start)
+{
+    Timer* t = (Timer*)calloc(1, sizeof(Timer));
+    glGenQueries(TIMER_RING, t->query);
+    t->start = start;
+    return t;
 }
 
-Feedback* feedback_new(GLuint samples)
+/*
+ *  Collects finished queries.  If wait is true, blocks until the oldest
+ *  query in flight is done.
+ */
+void timer_poll(Timer* t, bool wait)
 {
-    Feedback* f = (Feedback*)calloc(1, sizeof(Feedback));
+    while (t->tail != t->head)
+    {
+        GLuint q = t->query[t->tail % TIMER_RING];
+        GLint available = wait;
+        if (!wait)
+        {
+            glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+        }
+        if (!available)
+        {
+            break;
+        }
 
-    f->prog = glCreateProgram();
-    GLuint shader = shader_compile(GL_VERTEX_SHADER, feedback_src);
-    glAttachShader(f->prog, shader);
-    const GLchar* varying[] = { "pos" };
-    glTransformFeedbackVaryings(f->prog, 1, varying, GL_INTERLEAVED_ATTRIBS);
-    glLinkProgram(f->prog);
-    program_check(f->prog);
+        GLuint64 ns;
+        glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+        t->recent[t->measured++ % TIMER_RING] = ns * 1e-9;
+        t->tail++;
+        wait = false;
+    }
+}
 
-    f->vao = feedback_indices(samples);
+void timer_begin(Timer* t)
+{
+    if (t->head - t->tail == TIMER_RING)
+    {
+        timer_poll(t, true);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, t->query[t->head % TIMER_RING]);
+}
 
-    return f;
+void timer_end(Timer* t)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    t->head++;
 }
 
-void feedback_draw(Config* cfg, Voronoi* v, Sum* s, Feedback* f)
+/*
+ *  Checks whether another iteration is predicted to finish before the
+ *  deadline, accounting for iterations that are queued but not yet done
+ */
+bool timer_fits(Timer* t, double budget)
 {
-    glEnable(GL_RASTERIZER_DISCARD);
-    glBindVertexArray(f->vao);
-    glUseProgram(f->prog);
+    timer_poll(t, false);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, s->tex);
-    glUniform1i(glGetUniformLocation(f->prog, "tex"), 0);
-    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, v->pts);
+    double elapsed = wall_time() - t->start;
+    if (!t->measured)
+    {
+        return elapsed < budget;
+    }
 
-    glBeginTransformFeedback(GL_POINTS);
-    glDrawArrays(GL_POINTS, 0, cfg->samples);
-    glEndTransformFeedback();
+    /*  Be pessimistic and predict with the slowest recent iteration  */
+    double cost = 0;
+    unsigned n = t->measured < TIMER_RING ? t->measured : TIMER_RING;
+    for (unsigned i=0; i < n; ++i)
+    {
+        cost = fmax(cost, t->recent[i]);
+    }
 
-    glDisable(GL_RASTERIZER_DISCARD);
-    teardown(NULL);
+    return elapsed + (t->head - t->tail + 1) * cost <= budget;
 }
 
 /******************************************************************************/
@@ -669,14 +5708,14 @@ Stipples* stipples_new(Config* cfg, Voronoi* v)
 
     {   // Make and bind a VBO that draws a simple circle
         GLuint vbo;
-        size_t bytes = (2 + cfg->resolution) * 2 * sizeof(float);
+        size_t bytes = (2 + cfg->dot_resolution) * 2 * sizeof(float);
         float* buf = (float*)malloc(bytes);
 
         buf[0] = 0;
         buf[1] = 0;
-        for (size_t i=0; i <= cfg->resolution; ++i)
+        for (size_t i=0; i <= cfg->dot_resolution; ++i)
         {
-            float angle = 2 * M_PI * i / cfg->resolution;
+            float angle = 2 * M_PI * i / cfg->dot_resolution;
             buf[i*2 + 2] = cos(angle);
             buf[i*2 + 3] = sin(angle);
         }
@@ -711,17 +5750,219 @@ void stipples_draw(Config* cfg, Stipples* s)
     glUniform2f(glGetUniformLocation(s->prog, "radius"),
                 cfg->radius * cfg->sx, cfg->radius * cfg->sy);
     glBindVertexArray(s->vao);
-    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->resolution+2, cfg->samples);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, cfg->dot_resolution+2,
+                          cfg->samples);
 
     teardown(NULL);
 }
 
 /******************************************************************************/
 
+/*
+ *  Writes the stipples (as an array of x, y, weight triples in the 0-1 range)
+ *  to the given file as an SVG
+ */
+void svg_write(FILE* f, const Config* c, const float (*pts)[3])
+{
+    fprintf(f,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"\n"
+        "    viewBox=\"0 0 %u %u\" width=\"%u\" height=\"%u\" id=\"swingline\">\n",
+        c->out_width, c->out_height, c->out_width, c->out_height);
+
+    for (int i=0; i < c->samples; ++i)
+    {
+        fprintf(f,
+            "    <circle cx=\"%f\" cy=\"%f\" r=\"%f\" fill=\"black\" />\n",
+            c->out_width*pts[i][0], c->out_height - c->out_height*pts[i][1],
+            c->radius * fmin(c->sx, c->sy) * fmin(c->out_width, c->out_height) *
+                pts[i][2]);
+    }
+
+    fprintf(f, "</svg>");
+}
+
+/*
+ *  Writes the stipples to the output file (or to stdout if it's "-"),
+ *  returning 0 or EXIT_FAILURE
+ */
+int svg_save(const Config* c, const float (*pts)[3])
+{
+    bool pipe = !strcmp(c->out, "-");
+    FILE* f = pipe ? stdout : fopen(c->out, "w");
+    if (!f)
+    {
+        perror("File opening failed");
+        return EXIT_FAILURE;
+    }
+
+    /*  Stipples are written in their original order  */
+    float* unordered = c->order ? seeds_unordered(c, pts) : NULL;
+    svg_write(f, c, unordered ? (const float (*)[3])unordered : pts);
+    free(unordered);
+
+    if (pipe)
+    {
+        fflush(f);
+    }
+    else
+    {
+        fclose(f);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+
 void print_usage(char* prog)
 {
     fprintf(stderr, "Usage: %s [-n samples] [-r radius] [-o output] "
                               "[-i iterations] image\n", prog);
+    fprintf(stderr, "    Use - as the image or output name to read from stdin"
+                    " or write to stdout\n"
+                    "    --stream fd        write binary seed frames to fd\n"
+                    "    --stream-every k   stream a frame every k iterations"
+                    " (default 1)\n"
+                    "    --checkpoint file  periodically save progress to file,"
+                    " and on SIGTERM\n"
+                    "    --checkpoint-every k  save a checkpoint every k"
+                    " iterations (default 100)\n"
+                    "    --resume file      continue from a checkpoint\n"
+                    "    --time-budget s    stop iterating once s seconds have"
+                    " elapsed\n"
+                    "    --cell-pixels p    resample the image to about p"
+                    " pixels per cell\n"
+                    "    --sum engine       centroid summation engine:"
+                    " full (default), spans, boxes or sort\n"
+                    "    --threads t        worker threads for CPU passes\n"
+                    "    --sum-rows b       image rows per summation texel"
+                    " (default 1)\n"
+                    "    --sum-half         store seed-relative sums at half"
+                    " precision\n"
+                    "    --subsample n      estimate centroids from a growing"
+                    " subset of pixels\n"
+                    "                       for the first n iterations"
+                    " (full and boxes engines)\n"
+                    "    --label target     labelling target: cones"
+                    " (RGB and depth, default), packed\n"
+                    "                       (min-blended distance and label"
+                    " in one R32F texture),\n"
+                    "                       or quads (packed, with each seed"
+                    " drawn only over\n"
+                    "                       its previous cell's extent)\n"
+                    "    --cone-resolution n  segments per Voronoi cone"
+                    " (default: chosen for a\n"
+                    "                       sub-pixel error at the expected"
+                    " cell size)\n"
+                    "    --backend b        run on the gpu (default), the cpu,"
+                    " the cpu with a seed\n"
+                    "                       grid (grid), or the cpu with"
+                    " exact Delaunay cells\n"
+                    "                       (delaunay);"
+                    " cpu backends are non-interactive\n"
+                    "    --validate         check GPU labels against a CPU"
+                    " labelling (which can\n"
+                    "                       itself differ near ties between"
+                    " sub-pixel seeds)\n"
+                    "    --batch b          on a cpu backend, run minibatch"
+                    " k-means with b pixels\n"
+                    "                       per iteration instead of full"
+                    " iterations\n"
+                    "    --freeze d         stop summing cells whose seeds"
+                    " have moved less than\n"
+                    "                       d pixels per iteration for a"
+                    " while (active-set mode)\n"
+                    "    --relabel d        only relabel around seeds that"
+                    " have moved more than d\n"
+                    "                       pixels since they were last"
+                    " drawn (gpu backend)\n"
+                    "    --reseed           move the seeds of empty cells"
+                    " into the heaviest cells\n"
+                    "    --reorder k        sort the seeds along a Hilbert"
+                    " curve every k iterations\n"
+                    "    --sweep n1,n2,...  converge at each seed count in"
+                    " turn, splitting the\n"
+                    "                       heaviest cells to warm-start"
+                    " the next, and save each\n"
+                    "                       as output-n.svg"
+                    " (-i iterations per count)\n"
+                    "    --lbg              split and remove cells until"
+                    " each carries one dot's\n"
+                    "                       mass, so the stipple count"
+                    " follows the image and -r\n"
+                    "                       (-n is the starting count)\n"
+                    "    --skip-empty d     sum tiles lighter than darkness d"
+                    " (0 - 1) in closed form\n"
+                    "                       (full and boxes engines)\n");
+}
+
+/*
+ *  Loads a single-channel image from the given path, or from stdin if the
+ *  path is "-".  stdin is slurped into memory first, since pipes can't seek.
+ */
+stbi_uc* image_load(const char* path, int* x, int* y)
+{
+    if (strcmp(path, "-"))
+    {
+        return stbi_load(path, x, y, NULL, 1);
+    }
+
+    size_t size = 0;
+    size_t capacity = 1 << 16;
+    stbi_uc* buf = (stbi_uc*)malloc(capacity);
+
+    size_t n;
+    while ((n = fread(buf + size, 1, capacity - size, stdin)) > 0)
+    {
+        size += n;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            buf = (stbi_uc*)realloc(buf, capacity);
+        }
+    }
+
+    if (ferror(stdin) || size > INT_MAX)
+    {
+        fprintf(stderr, "Error: failed to read image from stdin\n");
+        exit(-1);
+    }
+
+    stbi_uc* img = stbi_load_from_memory(buf, (int)size, x, y, NULL, 1);
+    free(buf);
+    return img;
+}
+
+/*
+ *  Parses a comma-separated list of ascending seed counts (for --sweep),
+ *  exiting if it is malformed
+ */
+uint16_t* parse_counts(const char* arg, unsigned* count)
+{
+    uint16_t* counts = NULL;
+    *count = 0;
+
+    const char* p = arg;
+    while (true)
+    {
+        char* end;
+        errno = 0;
+        long n = strtol(p, &end, 10);
+        if (end == p || errno || n < 1 || n > UINT16_MAX ||
+            (*count && n <= counts[*count - 1]) || (*end && *end != ','))
+        {
+            fprintf(stderr, "Error: invalid sweep counts (%s)\n", arg);
+            exit(-1);
+        }
+
+        counts = (uint16_t*)realloc(counts, (*count + 1) * sizeof(uint16_t));
+        counts[(*count)++] = (uint16_t)n;
+        if (!*end)
+        {
+            return counts;
+        }
+        p = end + 1;
+    }
 }
 
 Config* parse_args(int argc, char** argv)
@@ -730,14 +5971,174 @@ Config* parse_args(int argc, char** argv)
     float r = 0.01f;
     int iter = -1;
     const char* out = NULL;
+    int stream = -1;
+    int stream_every = 1;
+    const char* checkpoint = NULL;
+    int checkpoint_every = 100;
+    const char* resume = NULL;
+    double budget = 0;
+    int cell_pixels = 0;
+    int sum = SUM_FULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int sum_rows = 1;
+    bool sum_half = false;
+    int subsample = 0;
+    float skip_empty = 0;
+    int label = LABEL_CONES;
+    int cone_resolution = 0;
+    int backend = BACKEND_GPU;
+    bool validate = false;
+    int batch = 0;
+    float freeze = 0;
+    float relabel = 0;
+    bool reseed = false;
+    int reorder = 0;
+    uint16_t* sweep = NULL;
+    unsigned sweep_count = 0;
+    bool lbg = false;
+
+    enum { OPT_STREAM = 256, OPT_STREAM_EVERY,
+           OPT_CHECKPOINT, OPT_CHECKPOINT_EVERY, OPT_RESUME,
+           OPT_TIME_BUDGET, OPT_CELL_PIXELS, OPT_SUM, OPT_THREADS,
+           OPT_SUM_ROWS, OPT_SUM_HALF, OPT_SUBSAMPLE, OPT_SKIP_EMPTY,
+           OPT_LABEL, OPT_CONE_RESOLUTION, OPT_BACKEND, OPT_VALIDATE,
+           OPT_BATCH, OPT_FREEZE, OPT_RELABEL, OPT_RESEED, OPT_REORDER,
+           OPT_SWEEP, OPT_LBG };
+    const struct option longopts[] = {
+        {"stream",           required_argument, NULL, OPT_STREAM},
+        {"stream-every",     required_argument, NULL, OPT_STREAM_EVERY},
+        {"checkpoint",       required_argument, NULL, OPT_CHECKPOINT},
+        {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+        {"resume",           required_argument, NULL, OPT_RESUME},
+        {"time-budget",      required_argument, NULL, OPT_TIME_BUDGET},
+        {"cell-pixels",      required_argument, NULL, OPT_CELL_PIXELS},
+        {"sum",              required_argument, NULL, OPT_SUM},
+        {"threads",          required_argument, NULL, OPT_THREADS},
+        {"sum-rows",         required_argument, NULL, OPT_SUM_ROWS},
+        {"sum-half",         no_argument,       NULL, OPT_SUM_HALF},
+        {"subsample",        required_argument, NULL, OPT_SUBSAMPLE},
+        {"skip-empty",       required_argument, NULL, OPT_SKIP_EMPTY},
+        {"label",            required_argument, NULL, OPT_LABEL},
+        {"cone-resolution",  required_argument, NULL, OPT_CONE_RESOLUTION},
+        {"backend",          required_argument, NULL, OPT_BACKEND},
+        {"validate",         no_argument,       NULL, OPT_VALIDATE},
+        {"batch",            required_argument, NULL, OPT_BATCH},
+        {"freeze",           required_argument, NULL, OPT_FREEZE},
+        {"relabel",          required_argument, NULL, OPT_RELABEL},
+        {"reseed",           no_argument,       NULL, OPT_RESEED},
+        {"reorder",          required_argument, NULL, OPT_REORDER},
+        {"sweep",            required_argument, NULL, OPT_SWEEP},
+        {"lbg",              no_argument,       NULL, OPT_LBG},
+        {NULL, 0, NULL, 0}};
 
     while (true)
     {
-        char c = getopt(argc, argv, "r:n:o:i:");
+        int c = getopt_long(argc, argv, "r:n:o:i:", longopts, NULL);
         if (c == -1) {  break; }
 
         switch (c)
         {
+            case OPT_STREAM:
+                stream = atoi(optarg);
+                break;
+            case OPT_STREAM_EVERY:
+                stream_every = atoi(optarg);
+                break;
+            case OPT_CHECKPOINT:
+                checkpoint = optarg;
+                break;
+            case OPT_CHECKPOINT_EVERY:
+                checkpoint_every = atoi(optarg);
+                break;
+            case OPT_RESUME:
+                resume = optarg;
+                break;
+            case OPT_TIME_BUDGET:
+                budget = atof(optarg);
+                break;
+            case OPT_CELL_PIXELS:
+                cell_pixels = atoi(optarg);
+                break;
+            case OPT_SUM:
+                if (!strcmp(optarg, "full"))        sum = SUM_FULL;
+                else if (!strcmp(optarg, "spans"))  sum = SUM_SPANS;
+                else if (!strcmp(optarg, "boxes"))  sum = SUM_BOXES;
+                else if (!strcmp(optarg, "sort"))   sum = SUM_SORT;
+                else
+                {
+                    fprintf(stderr, "Error: unknown summation engine (%s)\n",
+                            optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_THREADS:
+                threads = atoi(optarg);
+                break;
+            case OPT_SUM_ROWS:
+                sum_rows = atoi(optarg);
+                break;
+            case OPT_SUM_HALF:
+                sum_half = true;
+                break;
+            case OPT_SUBSAMPLE:
+                subsample = atoi(optarg);
+                break;
+            case OPT_SKIP_EMPTY:
+                skip_empty = atof(optarg);
+                break;
+            case OPT_BACKEND:
+                if (!strcmp(optarg, "gpu"))         backend = BACKEND_GPU;
+                else if (!strcmp(optarg, "cpu"))    backend = BACKEND_CPU;
+                else if (!strcmp(optarg, "grid"))   backend = BACKEND_GRID;
+                else if (!strcmp(optarg, "delaunay"))
+                {
+                    backend = BACKEND_DELAUNAY;
+                }
+                else
+                {
+                    fprintf(stderr, "Error: unknown backend (%s)\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case OPT_VALIDATE:
+                validate = true;
+                break;
+            case OPT_BATCH:
+                batch = atoi(optarg);
+                break;
+            case OPT_FREEZE:
+                freeze = atof(optarg);
+                break;
+            case OPT_RELABEL:
+                relabel = atof(optarg);
+                break;
+            case OPT_RESEED:
+                reseed = true;
+                break;
+            case OPT_REORDER:
+                reorder = atoi(optarg);
+                break;
+            case OPT_SWEEP:
+                free(sweep);
+                sweep = parse_counts(optarg, &sweep_count);
+                break;
+            case OPT_LBG:
+                lbg = true;
+                break;
+            case OPT_CONE_RESOLUTION:
+                cone_resolution = atoi(optarg);
+                break;
+            case OPT_LABEL:
+                if (!strcmp(optarg, "cones"))        label = LABEL_CONES;
+                else if (!strcmp(optarg, "packed"))  label = LABEL_PACKED;
+                else if (!strcmp(optarg, "quads"))   label = LABEL_QUADS;
+                else
+                {
+                    fprintf(stderr, "Error: unknown labelling target (%s)\n",
+                            optarg);
+                    exit(-1);
+                }
+                break;
             case 'n':
                 n = atoi(optarg);
                 break;
@@ -755,42 +6156,180 @@ Config* parse_args(int argc, char** argv)
                 exit(EXIT_FAILURE);
         };
     }
-
-    if (optind >= argc)
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "%s: expected filename after options\n", argv[0]);
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    else if (n > UINT16_MAX)
+    {
+        fprintf(stderr, "Error: too many points (%i)\n", n);
+        exit(-1);
+    }
+    else if (stream_every < 1)
+    {
+        fprintf(stderr, "Error: invalid stream interval (%i)\n", stream_every);
+        exit(-1);
+    }
+    else if (budget < 0)
+    {
+        fprintf(stderr, "Error: invalid time budget (%g)\n", budget);
+        exit(-1);
+    }
+    else if (cell_pixels < 0)
+    {
+        fprintf(stderr, "Error: invalid pixels per cell (%i)\n", cell_pixels);
+        exit(-1);
+    }
+    else if (sum_rows < 1)
+    {
+        fprintf(stderr, "Error: invalid rows per summation texel (%i)\n",
+                sum_rows);
+        exit(-1);
+    }
+    else if (subsample < 0)
+    {
+        fprintf(stderr, "Error: invalid subsampled iterations (%i)\n",
+                subsample);
+        exit(-1);
+    }
+    else if (reorder < 0)
+    {
+        fprintf(stderr, "Error: invalid reordering interval (%i)\n",
+                reorder);
+        exit(-1);
+    }
+    else if (cone_resolution < 0 || cone_resolution > TESSELLATION_MAX ||
+             (cone_resolution > 0 && cone_resolution < 3))
+    {
+        fprintf(stderr, "Error: invalid cone resolution (%i)\n",
+                cone_resolution);
+        exit(-1);
+    }
+    else if (skip_empty < 0 || skip_empty > 1)
+    {
+        fprintf(stderr, "Error: invalid empty tile threshold (%g)\n",
+                skip_empty);
+        exit(-1);
+    }
+    else if (relabel < 0)
+    {
+        fprintf(stderr, "Error: invalid relabel threshold (%g)\n", relabel);
+        exit(-1);
+    }
+    else if (freeze < 0)
+    {
+        fprintf(stderr, "Error: invalid freeze threshold (%g)\n", freeze);
+        exit(-1);
+    }
+    else if (batch < 0)
+    {
+        fprintf(stderr, "Error: invalid batch size (%i)\n", batch);
+        exit(-1);
+    }
+    else if (threads < 1)
+    {
+        fprintf(stderr, "Error: invalid thread count (%li)\n", threads);
+        exit(-1);
+    }
+    else if (checkpoint_every < 1)
+    {
+        fprintf(stderr, "Error: invalid checkpoint interval (%i)\n",
+                checkpoint_every);
+        exit(-1);
+    }
+
+    int x, y;
+    stbi_set_flip_vertically_on_load(true);
+    stbi_uc* img = image_load(argv[optind], &x, &y);
+
+    if (img == NULL)
+    {
+        fprintf(stderr, "Error loading image: %s\n", stbi_failure_reason());
+        exit(-1);
+    }
+    else if ((unsigned)x > UINT16_MAX || (unsigned)y > UINT16_MAX)
+    {
+        fprintf(stderr, "Error: image is too large (%i x %i)\n", x, y);
+        exit(-1);
+    }
+
+    if (out && strcmp(out, "-"))
+    {
+        size_t len = strlen(out);
+        if (len >= 4 && strcmp(out + len - 4, ".svg"))
+        {
+            fprintf(stderr, "Error: output file should end in .svg (%s)\n", out);
+            exit(-1);
+        }
+    }
+
+    if (sweep && (iter == -1 || budget))
+    {
+        fprintf(stderr, "Error: --sweep needs an iteration count\n");
+        exit(-1);
+    }
+    else if (sweep && (!out || !strcmp(out, "-")))
+    {
+        fprintf(stderr, "Error: --sweep needs an output file name\n");
+        exit(-1);
+    }
+    else if (sweep && (checkpoint || resume || cell_pixels))
+    {
+        fprintf(stderr, "Error: --sweep can't be combined with checkpoints"
+                        " or --cell-pixels\n");
+        exit(-1);
+    }
+
+    /*  A time budget implies non-interactive mode  */
+    if (budget && iter == -1)
+    {
+        iter = INT_MAX;
+    }
+
+    if (backend != BACKEND_GPU && iter == -1)
+    {
+        fprintf(stderr, "Error: the cpu backend needs an iteration count"
+                        " or time budget\n");
+        exit(-1);
+    }
+    else if (backend != BACKEND_GPU && validate)
+    {
+        fprintf(stderr, "Error: --validate checks the gpu backend\n");
+        exit(-1);
+    }
+    else if (batch && backend != BACKEND_CPU && backend != BACKEND_GRID)
     {
-        fprintf(stderr, "%s: expected filename after options\n", argv[0]);
-        print_usage(argv[0]);
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Error: --batch needs the cpu or grid backend\n");
+        exit(-1);
     }
-    else if (n > UINT16_MAX)
+    else if (backend != BACKEND_GPU && relabel)
     {
-        fprintf(stderr, "Error: too many points (%i)\n", n);
+        fprintf(stderr, "Error: --relabel applies to the gpu backend\n");
         exit(-1);
     }
-
-    int x, y;
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc* img = stbi_load(argv[optind], &x, &y, NULL, 1);
-
-    if (img == NULL)
+    else if (batch && freeze)
     {
-        fprintf(stderr, "Error loading image: %s\n", stbi_failure_reason());
+        fprintf(stderr, "Error: --freeze needs full iterations\n");
         exit(-1);
     }
-    else if ((unsigned)x > UINT16_MAX || (unsigned)y > UINT16_MAX)
+    else if (batch && reseed)
     {
-        fprintf(stderr, "Error: image is too large (%i x %i)\n", x, y);
+        fprintf(stderr, "Error: --reseed needs full iterations\n");
         exit(-1);
     }
-
-    if (out)
+    else if (lbg && (batch || freeze || reseed || reorder || sweep ||
+                     relabel || sum_half || cell_pixels || checkpoint ||
+                     resume))
     {
-        size_t len = strlen(out);
-        if (len >= 4 && strcmp(out + len - 4, ".svg"))
-        {
-            fprintf(stderr, "Error: output file should end in .svg (%s)\n", out);
-            exit(-1);
-        }
+        fprintf(stderr, "Error: --lbg sets its own seed count, so it can't"
+                        " be combined with --batch, --freeze,\n"
+                        "       --reseed, --reorder, --sweep, --relabel,"
+                        " --sum-half, --cell-pixels\n"
+                        "       or checkpoints\n");
+        exit(-1);
     }
 
     Config* c = (Config*)calloc(1, sizeof(Config));
@@ -798,25 +6337,231 @@ Config* parse_args(int argc, char** argv)
         .img = img,
         .width = (uint16_t)x,
         .height = (uint16_t)y,
-        .samples = (uint16_t)n,
-        .resolution = 256,
+        .out_width = (uint16_t)x,
+        .out_height = (uint16_t)y,
+        .samples = sweep ? sweep[0] : (uint16_t)n,
+        .label = label,
+        .sum = sum,
+        .backend = backend,
+        .validate = validate,
+        .batch = (unsigned)batch,
+        .freeze = freeze,
+        .relabel = relabel,
+        .reseed = reseed,
+        .reorder = (unsigned)reorder,
+        .sweep = sweep,
+        .sweep_count = sweep_count,
+        .cone_resolution = (uint16_t)cone_resolution,
+        .lbg = lbg,
+        .threads = (unsigned)threads,
+        .sum_rows = (unsigned)sum_rows,
+        .sum_half = sum_half,
+        .skip_empty = skip_empty,
         .radius = r,
         .iter = iter,
-        .out = out};
+        .subsample = subsample,
+        .budget = budget,
+        .out = out,
+        .stream = stream,
+        .stream_every = stream_every,
+        .checkpoint = checkpoint,
+        .checkpoint_every = checkpoint_every,
+        .resume = resume,
+        .rng = 88172645463325252ULL};
 
     config_set_aspect_ratio(c);
+    if (cell_pixels)
+    {
+        config_set_resolution(c, cell_pixels);
+    }
+    config_set_tessellation(c, cone_resolution);
+    config_set_hash(c);
+
+    config_set_order(c);
     return c;
 }
 
-int main(int argc, char** argv)
+/*  Set by the SIGTERM handler to stop the iteration loop  */
+static volatile sig_atomic_t terminated = 0;
+
+void on_sigterm(int sig)
 {
-    Config* c = parse_args(argc, argv);
-    GLFWwindow* win = make_context(c->width, c->height, c->iter != -1);
+    (void)sig;
+    terminated = 1;
+}
+
+/*
+ *  Runs a non-interactive job on a CPU backend, with the same streaming,
+ *  checkpointing and time budget as gpu_run (but without any OpenGL, so
+ *  seed frames and checkpoints are taken directly).  If seeds is non-NULL,
+ *  it receives the final seeds (in original order).
+ */
+int cpu_run(Config* c, const char* prog, double start, float* seeds)
+{
+    Cpu* u = cpu_new(c);
+
+    if (c->resume)
+    {
+        c->step = checkpoint_load(c->resume, c, u->pts);
+    }
+    if (c->stream != -1)
+    {
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    Checkpoint* k = NULL;
+    if (c->checkpoint)
+    {
+        k = checkpoint_new(c);
+        signal(SIGTERM, on_sigterm);
+    }
+
+    /*  Iterations are timed directly, predicting with the slowest so far  */
+    double cost = 0;
+    const int first = c->step;
+    while (c->step < c->iter && !terminated &&
+           (!c->budget || wall_time() - start + cost <= c->budget))
+    {
+        if (c->budget)
+        {
+            fprintf(stderr, "\r%s: %i (%.2f / %.2f s)", prog,
+                    c->step + 1, wall_time() - start, c->budget);
+        }
+        else
+        {
+            fprintf(stderr, "\r%s: %i / %i", prog, c->step + 1, c->iter);
+        }
+
+        double t = wall_time();
+        if (c->reorder && (c->step - first) % c->reorder == 0)
+        {
+            cpu_reorder(u);
+        }
+        cpu_step(u);
+        c->step++;
+        cost = fmax(cost, wall_time() - t);
+        if (u->reseed && u->reseed->count)
+        {
+            fprintf(stderr, " (reseeded %u empty cells)\n",
+                    u->reseed->count);
+        }
+
+        if (c->stream != -1 && c->step % c->stream_every == 0)
+        {
+            stream_write(c, c->step, (const float (*)[3])u->pts);
+        }
+        if (k && c->step % c->checkpoint_every == 0)
+        {
+            checkpoint_submit(k, c->step, c->rng, (const float (*)[3])u->pts);
+        }
+    }
+    fprintf(stderr, "\n");
+    if (u->dt)
+    {
+        dt_report(u->dt);
+    }
+    if (u->reseed)
+    {
+        reseed_report(u->reseed);
+    }
+    if (u->lbg)
+    {
+        lbg_report(u->lbg);
+    }
+    if (u->freeze)
+    {
+        freeze_report(u->freeze);
+    }
+
+    if (k)
+    {
+        if (terminated)
+        {
+            checkpoint_submit(k, c->step, c->rng, (const float (*)[3])u->pts);
+        }
+        checkpoint_flush(k);
+        if (terminated)
+        {
+            fprintf(stderr, "Terminated; checkpointed %i iterations to %s\n",
+                    c->step, c->checkpoint);
+            cpu_free(u);
+            return 128 + SIGTERM;
+        }
+    }
+
+    if (seeds)
+    {
+        seeds_save(c, (const float (*)[3])u->pts, seeds);
+    }
+    int err = c->out ? svg_save(c, (const float (*)[3])u->pts) : 0;
+    cpu_free(u);
+    return err;
+}
+
+/*
+ *  Runs the stipple update loop on the GPU, in the given window's context.
+ *  If seeds is non-NULL, it receives the final seeds (in original order).
+ */
+int gpu_run(Config* c, GLFWwindow* win, const char* prog, double start,
+            float* seeds)
+{
+    /*  With LBG, everything is sized for its capacity  */
+    const uint16_t samples = c->samples;
+    Lbg* l = c->lbg ? lbg_new(c) : NULL;
+    if (l)
+    {
+        c->samples = (uint16_t)l->capacity;
+    }
 
     /*  These are the three stages in the stipple update loop   */
     Voronoi* v = voronoi_new(c, c->img);
     Sum* s = sum_new(c);
-    Feedback* f = feedback_new(c->samples);
+    Feedback* f = feedback_new(c->samples, c->reseed || c->lbg);
+
+    /*  Pick up where a previous run left off  */
+    if (c->resume)
+    {
+        size_t bytes = 3 * sizeof(float) * c->samples;
+        float (*pts)[3] = (float (*)[3])malloc(bytes);
+        c->step = checkpoint_load(c->resume, c, pts);
+
+        glBindBuffer(GL_ARRAY_BUFFER, v->pts);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        free(pts);
+    }
+
+    /*  Seed frames are copied off the GPU asynchronously for streaming  */
+    Readback* r = NULL;
+    if (c->stream != -1)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        r = readback_new(3 * sizeof(float) * c->samples);
+    }
+
+    /*  Checkpoints are written in the background, and on SIGTERM  */
+    Checkpoint* k = NULL;
+    if (c->checkpoint)
+    {
+        k = checkpoint_new(c);
+        signal(SIGTERM, on_sigterm);
+    }
+
+    /*  Optionally check every GPU labelling against the CPU labeller  */
+    Fh* fh = c->validate ? fh_new(c) : NULL;
+    double differ_max = 0, differ_sum = 0;
+    unsigned validated = 0;
+
+    /*  Reseeding, active-set mode and incremental relabelling track  *
+     *  the seeds on the CPU                                           */
+    Grid* grid = (c->freeze || c->relabel) ? grid_new(c, NULL) : NULL;
+    Freeze* z = c->freeze ? freeze_new(c, grid) : NULL;
+    Dirty* dirty = c->relabel ? dirty_new(c, grid) : NULL;
+    Reseed* e = c->reseed ? reseed_new(c) : NULL;
+    float (*moved)[3] = (grid || e || l || c->reorder)
+        ? (float (*)[3])malloc(c->samples * sizeof(*moved)) : NULL;
+    c->samples = samples;
+    const int first = c->step;
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClearDepth(1.0f);
@@ -830,21 +6575,67 @@ int main(int argc, char** argv)
             shader_compile(GL_FRAGMENT_SHADER, blit_frag_src));
         Stipples* stipples = stipples_new(c, v);
 
-        while (!glfwWindowShouldClose(win))
+        while (!glfwWindowShouldClose(win) && !terminated)
         {
+            /*  Sort the seeds every so often, once any copies of them  *
+             *  in the old order have been written out                   */
+            if (c->reorder && (c->step - first) % c->reorder == 0)
+            {
+                if (r)
+                {
+                    stream_drain(c, r, true);
+                }
+                if (k)
+                {
+                    checkpoint_flush(k);
+                }
+                seeds_reorder(c, v, s, z, dirty, moved);
+            }
+
             /*  Render the current voronoi diagram's state to v->tex */
             voronoi_draw(c, v);
+            if (fh)
+            {
+                double d = voronoi_validate(c, v, fh);
+                differ_max = fmax(differ_max, d);
+                differ_sum += d;
+                validated++;
+            }
 
             /*  Calculate the centroids and write them to v->pts  */
             sum_draw(c, v, s);
             feedback_draw(c, v, s, f);
 
+            /*  Once the LBG count has settled, there's nothing to sync  */
+            Lbg* lbg = (l && !l->settled) ? l : NULL;
+            if (r && lbg)
+            {
+                /*  Streamed frames carry the current seed count  */
+                stream_drain(c, r, true);
+            }
+            if (e || lbg || z || dirty)
+            {
+                seeds_sync(c, v, s, f, e, lbg, z, dirty, moved);
+            }
+            c->step++;
+
+            if (r)
+            {
+                stream_update(c, r, v);
+            }
+            if (k)
+            {
+                checkpoint_update(c, k, v);
+            }
+
             /*  Then draw the quad   */
             glBindVertexArray(quad_vao);
             glUseProgram(blit_program);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, v->tex);
             glUniform1i(glGetUniformLocation(blit_program, "tex"), 0);
+            glUniform1i(glGetUniformLocation(blit_program, "label_bits"),
+                        config_label_bits(c));
 
             glDisable(GL_DEPTH_TEST);
             glClear(GL_COLOR_BUFFER_BIT);
@@ -861,50 +6652,392 @@ int main(int argc, char** argv)
     }
     else    /* Non-interactive mode */
     {
-        for (int i=0; i < c->iter; ++i)
+        Timer* t = c->budget ? timer_new(start) : NULL;
+
+        while (c->step < c->iter && !terminated &&
+               (!t || timer_fits(t, c->budget)))
         {
-            printf("\r%s: %i / %i", argv[0], i + 1, c->iter);
-            fflush(stdout);
+            if (t)
+            {
+                fprintf(stderr, "\r%s: %i (%.2f / %.2f s)", prog,
+                        c->step + 1, wall_time() - start, c->budget);
+                timer_begin(t);
+            }
+            else
+            {
+                fprintf(stderr, "\r%s: %i / %i", prog, c->step + 1,
+                        c->iter);
+            }
+
+            if (c->reorder && (c->step - first) % c->reorder == 0)
+            {
+                if (r)
+                {
+                    stream_drain(c, r, true);
+                }
+                if (k)
+                {
+                    checkpoint_flush(k);
+                }
+                seeds_reorder(c, v, s, z, dirty, moved);
+            }
             voronoi_draw(c, v);
+            if (fh)
+            {
+                double d = voronoi_validate(c, v, fh);
+                differ_max = fmax(differ_max, d);
+                differ_sum += d;
+                validated++;
+            }
             sum_draw(c, v, s);
             feedback_draw(c, v, s, f);
+
+            /*  Once the LBG count has settled, there's nothing to sync  */
+            Lbg* lbg = (l && !l->settled) ? l : NULL;
+            if (r && lbg)
+            {
+                /*  Streamed frames carry the current seed count  */
+                stream_drain(c, r, true);
+            }
+            if (e || lbg || z || dirty)
+            {
+                seeds_sync(c, v, s, f, e, lbg, z, dirty, moved);
+            }
+            c->step++;
+
+            if (t)
+            {
+                timer_end(t);
+            }
+            if (e && e->count)
+            {
+                fprintf(stderr, " (reseeded %u empty cells)\n", e->count);
+            }
+
+            if (r)
+            {
+                stream_update(c, r, v);
+            }
+            if (k)
+            {
+                checkpoint_update(c, k, v);
+            }
         }
-        printf("\n");
+        fprintf(stderr, "\n");
+        free(t);
+    }
+
+    if (fh)
+    {
+        fprintf(stderr, "Pixels labelled differently from the approximate"
+                        " CPU labeller: %.4f%% on average, %.4f%% at most\n",
+                100 * differ_sum / (validated ? validated : 1),
+                100 * differ_max);
+    }
+
+    if (e)
+    {
+        reseed_report(e);
+    }
+    if (l)
+    {
+        lbg_report(l);
+    }
+    if (z)
+    {
+        freeze_report(z);
+    }
+    if (dirty)
+    {
+        dirty_report(dirty);
     }
 
-    if (c->out)
+    if (c->label == LABEL_QUADS)
     {
-        FILE* f = fopen(c->out, "w");
-        if (!f)
+        fprintf(stderr, "Fell back to full cones in %u labellings\n",
+                voronoi_fallbacks(v));
+    }
+
+    if (r)
+    {
+        stream_drain(c, r, true);
+        if (r->dropped)
         {
-            perror("File opening failed");
-            return EXIT_FAILURE;
+            fprintf(stderr, "Warning: dropped %u streamed frames\n",
+                    r->dropped);
         }
+        free(r);
+    }
 
-        fprintf(f,
-            "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
-            "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"\n"
-            "    viewBox=\"0 0 %u %u\" width=\"%u\" height=\"%u\" id=\"swingline\">\n",
-            c->width, c->height, c->width, c->height);
+    if (k && terminated)
+    {
+        checkpoint_now(c, k, v);
+        fprintf(stderr, "Terminated; checkpointed %i iterations to %s\n",
+                c->step, c->checkpoint);
+        return 128 + SIGTERM;
+    }
+    else if (k)
+    {
+        checkpoint_flush(k);
+    }
 
+    int err = 0;
+    if (c->out || seeds)
+    {
         glBindBuffer(GL_ARRAY_BUFFER, v->pts);
         size_t bytes = 3 * sizeof(float) * c->samples;
-        float (*pts)[3] = (float (*)[3])malloc(3 * sizeof(bytes) * c->samples);
+        float (*pts)[3] = (float (*)[3])malloc(bytes);
         glGetBufferSubData(GL_ARRAY_BUFFER, 0, bytes, pts);
 
-        for (int i=0; i < c->samples; ++i)
+        err = c->out ? svg_save(c, (const float (*)[3])pts) : 0;
+        if (seeds)
         {
-            fprintf(f,
-                "    <circle cx=\"%f\" cy=\"%f\" r=\"%f\" fill=\"black\" />\n",
-                c->width*pts[i][0], c->height - c->height*pts[i][1],
-                c->radius * fmin(c->sx, c->sy) * fmin(c->width, c->height) *
-                    pts[i][2]);
+            seeds_save(c, (const float (*)[3])pts, seeds);
         }
-
         free(pts);
-        fprintf(f, "</svg>");
-        fclose(f);
     }
 
+    /*  Free the CPU-side state (GL objects go with the context)  */
+    if (fh)
+    {
+        fh_free(fh);
+    }
+    if (z)
+    {
+        freeze_free(z);
+    }
+    if (dirty)
+    {
+        dirty_free(dirty);
+    }
+    if (grid)
+    {
+        grid_free(grid);
+    }
+    if (e)
+    {
+        reseed_free(e);
+    }
+    if (l)
+    {
+        lbg_free(l);
+    }
+    free(moved);
+    sum_free(s);
+    free(f);
+    free(v);
+    return err;
+}
+
+/******************************************************************************/
+
+/*
+ *  Sample-count sweeps converge at the smallest count, then warm-start each
+ *  larger count by splitting the heaviest cells of the last one.  Cells
+ *  are weighed exactly with the grid labeller, and each new seed goes to
+ *  the cell with the most mass per piece, so a heavy cell may be split
+ *  several ways.  A cell's pieces are placed at the centroids of equal
+ *  sectors of a disk with the cell's area (about its own centroid), at a
+ *  random angle.
+ */
+static bool sweep_heavier(const double* mass, const uint32_t* pieces,
+                          uint32_t a, uint32_t b)
+{
+    return mass[a] * pieces[b] > mass[b] * pieces[a];
+}
+
+static void sweep_sift(uint32_t* heap, unsigned n, unsigned i,
+                       const double* mass, const uint32_t* pieces)
+{
+    while (true)
+    {
+        unsigned top = i;
+        const unsigned l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && sweep_heavier(mass, pieces, heap[l], heap[top]))
+        {
+            top = l;
+        }
+        if (r < n && sweep_heavier(mass, pieces, heap[r], heap[top]))
+        {
+            top = r;
+        }
+        if (top == i)
+        {
+            return;
+        }
+        const uint32_t t = heap[i];
+        heap[i] = heap[top];
+        heap[top] = t;
+        i = top;
+    }
+}
+
+/*
+ *  Returns newly allocated seeds for c->samples cells, made by splitting
+ *  the given converged seeds (from of them)
+ */
+float* sweep_split(Config* c, const float (*pts)[3], unsigned from)
+{
+    const unsigned to = c->samples;
+
+    /*  Weigh the cells at the old count  */
+    c->samples = from;
+    double (*sums)[4] = (double (*)[4])malloc(
+            c->threads * from * sizeof(*sums));
+    Grid* g = grid_new(c, sums);
+    grid_label(g, pts);
+    grid_free(g);
+    c->samples = to;
+
+    double (*cell)[4] = (double (*)[4])calloc(from, sizeof(*cell));
+    double* mass = (double*)malloc(from * sizeof(double));
+    for (unsigned t=0; t < c->threads; ++t)
+    {
+        for (unsigned i=0; i < from; ++i)
+        {
+            for (unsigned k=0; k < 4; ++k)
+            {
+                cell[i][k] += sums[t * from + i][k];
+            }
+        }
+    }
+    free(sums);
+
+    /*  Hand out the new seeds one at a time, heaviest pieces first  */
+    uint32_t* pieces = (uint32_t*)malloc(from * sizeof(uint32_t));
+    uint32_t* heap = (uint32_t*)malloc(from * sizeof(uint32_t));
+    for (unsigned i=0; i < from; ++i)
+    {
+        mass[i] = cell[i][3];
+        pieces[i] = 1;
+        heap[i] = i;
+    }
+    for (unsigned i=from / 2; i-- > 0;)
+    {
+        sweep_sift(heap, from, i, mass, pieces);
+    }
+    for (unsigned n=from; n < to; ++n)
+    {
+        pieces[heap[0]]++;
+        sweep_sift(heap, from, 0, mass, pieces);
+    }
+
+    float (*out)[3] = (float (*)[3])malloc(to * sizeof(*out));
+    unsigned next = from;
+    for (unsigned i=0; i < from; ++i)
+    {
+        memcpy(out[i], pts[i], sizeof(*out));
+        const unsigned k = pieces[i];
+        if (k == 1 || cell[i][2] <= 0)
+        {
+            /*  An empty cell can't have been split, as its mass is 0  */
+            continue;
+        }
+
+        const double cx = cell[i][0] / cell[i][3];
+        const double cy = cell[i][1] / cell[i][3];
+        const double r = sqrt(cell[i][2] / M_PI);
+        const double rho = (2.0 / 3.0) * r * sin(M_PI / k) / (M_PI / k);
+        const double a = config_rand(c) * (2 * M_PI / 4294967296.0);
+        for (unsigned j=0; j < k; ++j)
+        {
+            const unsigned slot = j ? next++ : i;
+            const double b = a + 2 * M_PI * j / k;
+            out[slot][0] = fmin(fmax(cx + rho * cos(b) / c->width, 0), 1);
+            out[slot][1] = fmin(fmax(cy + rho * sin(b) / c->height, 0), 1);
+            out[slot][2] = pts[i][2];
+        }
+    }
+    assert(next == to);
+
+    free(cell);
+    free(mass);
+    free(pieces);
+    free(heap);
+    return (float*)out;
+}
+
+/*
+ *  Returns a newly allocated output name for one count of a sweep, with
+ *  the count before the extension (out.svg becomes out-2000.svg)
+ */
+char* sweep_name(const char* out, unsigned count)
+{
+    const size_t len = strlen(out);
+    const size_t stem = (len >= 4 && !strcmp(out + len - 4, ".svg"))
+                      ? len - 4 : len;
+    char* name = (char*)malloc(len + 16);
+    sprintf(name, "%.*s-%u%s", (int)stem, out, count, out + stem);
+    return name;
+}
+
+/*
+ *  Runs a full sweep, on the configured backend.  Each count on the GPU
+ *  gets a fresh (hidden) context, which frees the last count's objects.
+ */
+int sweep_run(Config* c, const char* prog, double start)
+{
+    const char* out = c->out;
+    float* pts = NULL;
+    for (unsigned l=0; l < c->sweep_count && !terminated; ++l)
+    {
+        const double t = wall_time();
+        const unsigned from = c->samples;
+        c->samples = c->sweep[l];
+        if (pts)
+        {
+            c->seeds = sweep_split(c, (const float (*)[3])pts, from);
+            config_set_tessellation(c, c->cone_resolution);
+        }
+        config_set_order(c);
+        c->step = 0;
+
+        char* name = sweep_name(out, c->samples);
+        c->out = name;
+        pts = (float*)realloc(pts, c->samples * 3 * sizeof(float));
+
+        int err;
+        if (c->backend == BACKEND_GPU)
+        {
+            GLFWwindow* win = make_context(c->width, c->height, true);
+            err = gpu_run(c, win, prog, start, pts);
+            glfwDestroyWindow(win);
+        }
+        else
+        {
+            err = cpu_run(c, prog, start, pts);
+        }
+
+        free(c->seeds);
+        c->seeds = NULL;
+        c->out = out;
+        if (err)
+        {
+            free(name);
+            free(pts);
+            return err;
+        }
+        fprintf(stderr, "Sweep: %u seeds (%s) in %.2f s\n",
+                c->samples, name, wall_time() - t);
+        free(name);
+    }
+    free(pts);
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+    double start = wall_time();
+    Config* c = parse_args(argc, argv);
+    if (c->sweep)
+    {
+        return sweep_run(c, argv[0], start);
+    }
+    else if (c->backend != BACKEND_GPU)
+    {
+        return cpu_run(c, argv[0], start, NULL);
+    }
+
+    GLFWwindow* win = make_context(c->width, c->height, c->iter != -1);
+    return gpu_run(c, win, argv[0], start, NULL);
+}